@@ -0,0 +1,74 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_ARENA_HPP_
+#define INCLUDE_INJA_ARENA_HPP_
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+
+namespace inja {
+
+using json = nlohmann::json;
+
+/*!
+ * \brief Bump allocator for the temporary values of a render.
+ *
+ * Values are constructed in place into fixed-size blocks. rewind() destroys
+ * the values created after a mark but keeps the blocks, so a render reuses
+ * the same memory for the temporaries of every expression.
+ */
+class JsonArena {
+  static constexpr size_t block_size {64};
+
+  struct Block {
+    typename std::aligned_storage<sizeof(json), alignof(json)>::type values[block_size];
+  };
+
+  std::vector<std::unique_ptr<Block>> blocks;
+  size_t count {0};
+
+  json* slot(size_t index) {
+    return reinterpret_cast<json*>(&blocks[index / block_size]->values[index % block_size]);
+  }
+
+public:
+  JsonArena() = default;
+  JsonArena(const JsonArena&) = delete;
+  JsonArena& operator=(const JsonArena&) = delete;
+
+  ~JsonArena() {
+    rewind(0);
+  }
+
+  template<typename... Args>
+  json* make(Args&&... args) {
+    if (count / block_size == blocks.size()) {
+      blocks.emplace_back(new Block);
+    }
+    json* value = new (slot(count)) json(std::forward<Args>(args)...);
+    count += 1;
+    return value;
+  }
+
+  /// Number of live values, usable as a mark for rewind()
+  size_t size() const {
+    return count;
+  }
+
+  /// Destroys all values created after mark
+  void rewind(size_t mark) {
+    while (count > mark) {
+      count -= 1;
+      slot(count)->~json();
+    }
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_ARENA_HPP_
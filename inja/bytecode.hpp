@@ -0,0 +1,61 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_BYTECODE_HPP_
+#define INCLUDE_INJA_BYTECODE_HPP_
+
+#include <cstdint>
+
+#include "function_storage.hpp"
+#include "node.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A single instruction of a compiled Template.
+ *
+ * Instructions live in one contiguous array and refer back to the AST node
+ * they were lowered from for their payload (text, literal, variable, ...)
+ * and for the source position used in error messages.
+ */
+struct Bytecode {
+  enum class Op : uint8_t {
+    Nop,
+    // print the text of a TextNode
+    PrintText,
+    // pop the value of an ExpressionListNode and print it, escaped unless args is 1 for safe()
+    PrintValue,
+    // push the value of a LiteralNode
+    PushLiteral,
+    // push the value of a JsonNode
+    PushVar,
+    // call a builtin or callback with its arguments on the stack
+    Call,
+    // decide the and, or or default() of operation by its first operand on
+    // the stack, and jump to args past the call if the second one is not needed
+    ShortCircuit,
+    // jump to args
+    Jump,
+    // pop the condition of an IfStatementNode and jump to args if it is false
+    ConditionalJump,
+    // pop the container of a ForStatementNode and start the loop, or jump to args if it is empty
+    StartArrayLoop,
+    StartObjectLoop,
+    // advance the innermost loop and jump back to args, or leave it
+    EndLoop,
+    // render the template of an IncludeStatementNode
+    Include,
+  };
+
+  Op op;
+  FunctionStorage::Operation operation {FunctionStorage::Operation::None};
+  uint32_t args {0};
+  const AstNode *node {nullptr};
+
+  explicit Bytecode(Op op, const AstNode *node, uint32_t args = 0) : op(op), args(args), node(node) {}
+  explicit Bytecode(FunctionStorage::Operation operation, const AstNode *node, uint32_t args)
+      : op(Op::Call), operation(operation), args(args), node(node) {}
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_BYTECODE_HPP_
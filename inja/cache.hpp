@@ -0,0 +1,140 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_CACHE_HPP_
+#define INCLUDE_INJA_CACHE_HPP_
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <accelerator/Range.h>
+
+#include "config.hpp"
+#include "exceptions.hpp"
+#include "file.hpp"
+#include "function_storage.hpp"
+#include "serializer.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A parsed Template stored on disk.
+ *
+ * The cache file is named after a hash of the template content, the path
+ * its includes are resolved against and the LexerConfig, so a changed
+ * source or syntax never matches an old entry.
+ */
+class TemplateCache {
+  static constexpr uint64_t format_version {3};
+
+  std::string filename;
+  uint64_t key;
+  size_t content_size;
+
+  static void hash(uint64_t &h, acc::StringPiece data) {
+    // multiply-xorshift over four independent lanes of 8 bytes
+    auto mix = [](uint64_t state, uint64_t word) {
+      state = (state ^ word) * 0x9e3779b97f4a7c15ULL;
+      return state ^ (state >> 29);
+    };
+    uint64_t lanes[4] = {h, h + 1, h + 2, h + 3};
+    size_t i = 0;
+    for (; i + 32 <= data.size(); i += 32) {
+      for (size_t lane = 0; lane < 4; ++lane) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i + lane * 8, 8);
+        lanes[lane] = mix(lanes[lane], word);
+      }
+    }
+    for (; i < data.size(); i += 8) {
+      uint64_t word = 0;
+      std::memcpy(&word, data.data() + i, std::min<size_t>(8, data.size() - i));
+      lanes[0] = mix(lanes[0], word);
+    }
+    h = mix(mix(mix(mix(lanes[0], lanes[1]), lanes[2]), lanes[3]), data.size());
+  }
+
+  void write_header(AstWriter &writer) const {
+    writer.write_string("INJA");
+    writer.write_uint(format_version);
+    writer.write_uint(key);
+    writer.write_uint(content_size);
+  }
+
+public:
+  explicit TemplateCache(const std::string &directory, const Template &tmpl, acc::StringPiece path,
+                         const LexerConfig &config) : key(0xcbf29ce484222325ULL), content_size(tmpl.content.size()) {
+    hash(key, tmpl.content);
+    hash(key, path);
+    for (auto &delimiter : {config.statement_open, config.statement_open_no_lstrip, config.statement_open_force_lstrip,
+                            config.statement_close, config.statement_close_force_rstrip, config.line_statement,
+                            config.expression_open, config.expression_close, config.comment_open, config.comment_close}) {
+      hash(key, delimiter);
+    }
+    hash(key, config.trim_blocks ? "1" : "0");
+    hash(key, config.lstrip_blocks ? "1" : "0");
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.injac", static_cast<unsigned long long>(key));
+    filename = directory;
+    if (!filename.empty() && filename.back() != '/') {
+      filename += '/';
+    }
+    filename += name;
+  }
+
+  /// Reads the AST of tmpl from the cache, returns false if there is no valid entry
+  bool load(Template &tmpl, const FunctionStorage &function_storage) const {
+    if (::access(filename.c_str(), R_OK) != 0) {
+      return false;
+    }
+    try {
+      MappedFile file(filename);
+      std::string header;
+      AstWriter header_writer(header);
+      write_header(header_writer);
+      auto data = file.data();
+      if (!data.startsWith(header)) {
+        return false;
+      }
+      data.advance(header.size());
+
+      AstReader reader(data, tmpl.content, function_storage);
+      if (reader.read(tmpl.root)) {
+        return true;
+      }
+    } catch (const FileError &) { }
+    tmpl.root.nodes.clear();
+    return false;
+  }
+
+  /// Writes the AST of tmpl to the cache; failures only cost a later reparse
+  void store(const Template &tmpl) const {
+    std::string data;
+    AstWriter writer(data);
+    write_header(writer);
+    writer.write(tmpl.root);
+
+    // Write to a temporary file first, so readers never see a partial entry
+    std::string temp_filename = filename + ".XXXXXX";
+    int fd = ::mkstemp(&temp_filename[0]);
+    if (fd < 0) {
+      return;
+    }
+    bool written = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    ::close(fd);
+    if (!written || std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      ::unlink(temp_filename.c_str());
+    }
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_CACHE_HPP_
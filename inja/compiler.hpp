@@ -0,0 +1,167 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_COMPILER_HPP_
+#define INCLUDE_INJA_COMPILER_HPP_
+
+#include <utility>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "function_storage.hpp"
+#include "node.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A class for lowering the AST of a Template into bytecode.
+ */
+class Compiler : public NodeVisitor {
+  std::vector<Bytecode> bytecodes;
+
+  size_t emit(Bytecode::Op op, const AstNode *node, uint32_t args = 0) {
+    bytecodes.emplace_back(op, node, args);
+    return bytecodes.size() - 1;
+  }
+
+  void patch(size_t index) {
+    bytecodes[index].args = bytecodes.size();
+  }
+
+  static bool is_short_circuit(FunctionStorage::Operation operation) {
+    using Op = FunctionStorage::Operation;
+    return operation == Op::And || operation == Op::Or || operation == Op::Default;
+  }
+
+  void compile_expression(const ExpressionListNode& node) {
+    const auto& rpn = node.rpn_output;
+
+    // Find where the second operand of each and, or and default() starts
+    std::vector<const FunctionNode *> skipped_by(rpn.size(), nullptr);
+    std::vector<size_t> operand_starts;
+    for (size_t i = 0; i < rpn.size(); ++i) {
+      size_t start = i;
+      if (auto function = dynamic_cast<const FunctionNode *>(rpn[i].get())) {
+        size_t args = function->arity();
+        if (args > operand_starts.size()) {
+          skipped_by.assign(rpn.size(), nullptr);  // malformed, left for the renderer to report
+          break;
+        }
+        if (args == 2 && is_short_circuit(function->operation)) {
+          skipped_by[operand_starts.back()] = function;
+        }
+        if (args > 0) {
+          start = operand_starts[operand_starts.size() - args];
+          operand_starts.resize(operand_starts.size() - args);
+        }
+      }
+      operand_starts.push_back(start);
+    }
+
+    std::vector<std::pair<const AstNode *, size_t>> pending_jumps;
+    for (size_t i = 0; i < rpn.size(); ++i) {
+      if (auto function = skipped_by[i]) {
+        size_t jump = emit(Bytecode::Op::ShortCircuit, function);
+        bytecodes[jump].operation = function->operation;
+        pending_jumps.emplace_back(function, jump);
+      }
+      rpn[i]->accept(*this);
+      while (!pending_jumps.empty() && pending_jumps.back().first == rpn[i].get()) {
+        patch(pending_jumps.back().second);
+        pending_jumps.pop_back();
+      }
+    }
+  }
+
+  void compile_loop(Bytecode::Op op, const ForStatementNode& node) {
+    compile_expression(node.condition);
+    size_t start = emit(op, &node);
+    node.body.accept(*this);
+    emit(Bytecode::Op::EndLoop, &node, start + 1);
+    patch(start);
+  }
+
+  void visit(const BlockNode& node) {
+    for (auto& n : node.nodes) {
+      n->accept(*this);
+    }
+  }
+
+  void visit(const TextNode& node) {
+    emit(Bytecode::Op::PrintText, &node);
+  }
+
+  void visit(const ExpressionNode&) { }
+
+  void visit(const LiteralNode& node) {
+    emit(Bytecode::Op::PushLiteral, &node);
+  }
+
+  void visit(const JsonNode& node) {
+    emit(Bytecode::Op::PushVar, &node);
+  }
+
+  void visit(const FunctionNode& node) {
+    bytecodes.emplace_back(node.operation, &node, node.number_args);
+  }
+
+  void visit(const ExpressionListNode& node) {
+    compile_expression(node);
+    emit(Bytecode::Op::PrintValue, &node, is_safe(node) ? 1 : 0);
+  }
+
+  void visit(const StatementNode&) { }
+  void visit(const ForStatementNode&) { }
+
+  void visit(const ForArrayStatementNode& node) {
+    compile_loop(Bytecode::Op::StartArrayLoop, node);
+  }
+
+  void visit(const ForObjectStatementNode& node) {
+    compile_loop(Bytecode::Op::StartObjectLoop, node);
+  }
+
+  void visit(const IfStatementNode& node) {
+    compile_expression(node.condition);
+    size_t condition_jump = emit(Bytecode::Op::ConditionalJump, &node);
+    node.true_statement.accept(*this);
+
+    if (node.has_false_statement) {
+      size_t end_jump = emit(Bytecode::Op::Jump, &node);
+      patch(condition_jump);
+      node.false_statement.accept(*this);
+      patch(end_jump);
+    } else {
+      patch(condition_jump);
+    }
+  }
+
+  void visit(const IncludeStatementNode& node) {
+    emit(Bytecode::Op::Include, &node);
+  }
+
+public:
+  /// Whether the value of an expression is marked safe(), so it is printed as is
+  static bool is_safe(const ExpressionListNode& node) {
+    if (node.rpn_output.empty()) {
+      return false;
+    }
+    auto function = dynamic_cast<const FunctionNode *>(node.rpn_output.back().get());
+    return function && function->operation == FunctionStorage::Operation::Safe;
+  }
+
+  std::vector<Bytecode> compile(const ExpressionListNode& expression) {
+    bytecodes.clear();
+    compile_expression(expression);
+    return std::move(bytecodes);
+  }
+
+  std::vector<Bytecode> compile(const BlockNode& root) {
+    bytecodes.clear();
+    root.accept(*this);
+    return std::move(bytecodes);
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_COMPILER_HPP_
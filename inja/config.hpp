@@ -54,6 +54,21 @@ struct LexerConfig {
  */
 struct ParserConfig {
   bool search_included_templates_in_files {true};
+  // directory of parsed templates stored on disk, empty for none
+  std::string cache_directory;
+  // includes of templates with at most this many bytecodes are inlined, 0 for none
+  size_t max_inlined_include_size {0};
+};
+
+/*!
+ * \brief How printed values are escaped; Json escapes for the inside of a string.
+ */
+enum class EscapeMode {
+  None,
+  Html,
+  Xml,
+  Json,
+  Url,
 };
 
 /*!
@@ -61,6 +76,7 @@ struct ParserConfig {
  */
 struct RenderConfig {
   bool throw_at_missing_includes {true};
+  EscapeMode escape_mode {EscapeMode::None};
 };
 
 } // namespace inja
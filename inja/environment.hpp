@@ -3,17 +3,30 @@
 #ifndef INCLUDE_INJA_ENVIRONMENT_HPP_
 #define INCLUDE_INJA_ENVIRONMENT_HPP_
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
-#include <sstream>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <accelerator/Range.h>
 
 #include "config.hpp"
+#include "file.hpp"
 #include "function_storage.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
 #include "renderer.hpp"
+#include "serializer.hpp"
+#include "sink.hpp"
 #include "template.hpp"
 #include "utils.hpp"
 #include "nlohmann/json.hpp"
@@ -24,6 +37,10 @@ using json = nlohmann::json;
 
 /*!
  * \brief Class for changing the configuration.
+ *
+ * render() and render_to() of a parsed Template are const and may run
+ * concurrently, also with parse() and include_template(). Changing the
+ * configuration or adding callbacks while rendering is not supported.
  */
 class Environment {
   std::string input_path;
@@ -34,7 +51,19 @@ class Environment {
   RenderConfig render_config;
 
   FunctionStorage function_storage;
-  TemplateStorage template_storage;
+  SharedTemplateStorage template_storage;
+
+  friend class TemplateWatcher;
+
+  /// Stores the included templates that a parse loaded from files, keeping any version stored meanwhile
+  void store_loaded_templates(const TemplateStorage &loaded) {
+    if (loaded.empty()) {
+      return;
+    }
+    template_storage.update([&](TemplateStorage &templates) {
+      templates.insert(loaded.begin(), loaded.end());
+    });
+  }
 
 public:
   Environment() : Environment("") {}
@@ -89,20 +118,48 @@ public:
     parser_config.search_included_templates_in_files = search_in_files;
   }
 
+  /// Sets the directory that parsed templates are cached in, empty to disable the cache
+  void set_cache_directory(const std::string &directory) {
+    parser_config.cache_directory = directory;
+  }
+
+  /** Sets the size in bytecodes up to which included templates are inlined
+   * into the templates parsed afterwards, 0 (the default) to disable it.
+   * Only templates that include nothing themselves are inlined; their text
+   * then merges with the surrounding text and constants fold across them.
+   * An inlined template stays as it was when parsing, until reloading.
+   */
+  void set_max_inlined_include_size(size_t max_size) {
+    parser_config.max_inlined_include_size = max_size;
+  }
+
+  /// Sets how printed values are escaped; values marked safe() are printed as is
+  void set_escape_mode(EscapeMode mode) {
+    render_config.escape_mode = mode;
+  }
+
   /// Sets whether a missing include will throw an error
   void set_throw_at_missing_includes(bool will_throw) {
     render_config.throw_at_missing_includes = will_throw;
   }
 
   Template parse(acc::StringPiece input) {
-    Parser parser(parser_config, lexer_config, template_storage, function_storage);
-    return parser.parse(input);
+    // parses run concurrently against a snapshot, only new includes are stored afterwards
+    auto templates = template_storage.snapshot();
+    TemplateStorage loaded;
+    Parser parser(parser_config, lexer_config, *templates, loaded, function_storage);
+    auto result = parser.parse(input);
+    store_loaded_templates(loaded);
+    return result;
   }
 
   Template parse_template(const std::string &filename) {
-    Parser parser(parser_config, lexer_config, template_storage, function_storage);
-    auto result = Template(parser.load_file(input_path + filename));
+    auto result = Template(Parser::load_file(input_path + filename));
+    auto templates = template_storage.snapshot();
+    TemplateStorage loaded;
+    Parser parser(parser_config, lexer_config, *templates, loaded, function_storage);
     parser.parse_into_template(result, input_path + filename);
+    store_loaded_templates(loaded);
     return result;
   }
 
@@ -112,10 +169,12 @@ public:
 
   std::string render(acc::StringPiece input, const json &data) { return render(parse(input), data); }
 
-  std::string render(const Template &tmpl, const json &data) {
-    std::stringstream os;
-    render_to(os, tmpl, data);
-    return os.str();
+  std::string render(const Template &tmpl, const json &data) const {
+    std::string result;
+    StringSink sink(result, tmpl.output_size_hint());
+    render_to(sink, tmpl, data);
+    tmpl.size_hint.update(result.size());
+    return result;
   }
 
   std::string render_file(const std::string &filename, const json &data) {
@@ -150,22 +209,54 @@ public:
     write(temp, data, filename_out);
   }
 
-  std::ostream &render_to(std::ostream &os, const Template &tmpl, const json &data) {
-    Renderer(render_config, template_storage, function_storage).render_to(os, tmpl, data);
+  std::ostream &render_to(std::ostream &os, const Template &tmpl, const json &data) const {
+    StreamSink sink(os);
+    render_to(sink, tmpl, data);
     return os;
   }
 
+  /// Renders into any OutputSink, e.g. a BufferSink or an IovecSink, which holds the included templates it refers to
+  void render_to(OutputSink &sink, const Template &tmpl, const json &data) const {
+    auto templates = template_storage.snapshot();
+    Renderer(render_config, *templates).render_to(sink, tmpl, data);
+  }
+
+  /*!
+  @brief Returns a copy of a template with the parts that only depend on static_data evaluated
+
+  Variables found in static_data are taken from it, the rest is looked up in
+  the data of each render. Likewise exists() is true for the names in
+  static_data and checks the data of each render for other names. Included
+  templates without includes of their own are inlined and specialized too;
+  the others look up variables the same way, in a copy of static_data that
+  the result keeps.
+  */
+  Template specialize(const Template &tmpl, const json &static_data) const {
+    Template result(tmpl.content);
+    std::string ast;
+    AstWriter(ast).write(tmpl.root);
+    if (!AstReader(ast, result.content, function_storage).read(result.root)) {
+      throw RenderError("failed copying template for specialization");
+    }
+    result.static_data = std::make_shared<const json>(static_data);
+
+    auto templates = template_storage.snapshot();
+    Parser::link_includes(result, *templates);
+    Optimizer optimizer(result, function_storage, result.static_data.get());
+    optimizer.optimize();
+    optimizer.inline_includes(std::numeric_limits<size_t>::max());
+    Parser::compile(result);
+    return result;
+  }
+
   std::string load_file(const std::string &filename) {
-    Parser parser(parser_config, lexer_config, template_storage, function_storage);
-    return parser.load_file(input_path + filename);
+    return Parser::load_file(input_path + filename);
   }
 
   json load_json(const std::string &filename) {
-    std::ifstream file;
-    open_file_or_throw(input_path + filename, file);
-    json j;
-    file >> j;
-    return j;
+    MappedFile file(input_path + filename);
+    auto content = file.data();
+    return json::parse(content.begin(), content.end());
   }
 
   /*!
@@ -177,6 +268,8 @@ public:
 
   /*!
   @brief Adds a callback with given number or arguments
+
+  It replaces a builtin function with the same name and number of arguments.
   */
   void add_callback(const std::string &name, int num_args, const CallbackFunction &callback) {
     function_storage.add_callback(name, num_args, callback);
@@ -187,7 +280,214 @@ public:
    * include "<name>" syntax.
    */
   void include_template(const std::string &name, const Template &tmpl) {
-    template_storage[name] = tmpl;
+    template_storage.update([&](TemplateStorage &templates) {
+      templates[name] = std::make_shared<const Template>(tmpl);
+    });
+  }
+
+  /** Loads and parses all files below a directory whose name matches a glob
+   * pattern, on up to num_threads threads (0 for one per core). Each template
+   * is stored under the name an include refers to it by, i.e. input path +
+   * path + file name, and all of them are published at once.
+   */
+  void load_directory(const std::string &path, const std::string &pattern = "*", size_t num_threads = 0) {
+    std::string directory = input_path + path;
+    if (!directory.empty() && directory.back() != '/') {
+      directory += '/';
+    }
+    const auto filenames = list_files(directory, pattern);
+
+    // Includes are linked once all files are stored, so the files can be
+    // parsed independently; includes from outside are loaded afterwards.
+    ParserConfig independent_config = parser_config;
+    independent_config.search_included_templates_in_files = false;
+
+    std::vector<std::shared_ptr<Template>> templates(filenames.size());
+    std::atomic<size_t> next_file {0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto parse_files = [&] {
+      TemplateStorage unused;
+      for (size_t i; (i = next_file++) < filenames.size(); ) {
+        try {
+          auto tmpl = Parser::load_template(directory + filenames[i]);
+          Parser parser(independent_config, lexer_config, unused, unused, function_storage);
+          parser.parse_into_template(*tmpl, directory + filenames[i]);
+          templates[i] = tmpl;
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+          next_file = filenames.size();
+        }
+      }
+    };
+
+    if (num_threads == 0) {
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    num_threads = std::min(num_threads, filenames.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; ++i) {
+      threads.emplace_back(parse_files);
+    }
+    parse_files();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    template_storage.update([&](TemplateStorage &storage) {
+      for (size_t i = 0; i < filenames.size(); ++i) {
+        storage[directory + filenames[i]] = templates[i];
+      }
+      if (parser_config.search_included_templates_in_files) {
+        Parser parser(parser_config, lexer_config, storage, storage, function_storage);
+        for (auto &tmpl : templates) {
+          for (auto &bc : tmpl->bytecodes) {
+            if (bc.op == Bytecode::Op::Include) {
+              parser.load_included_template(static_cast<const IncludeStatementNode &>(*bc.node).file);
+            }
+          }
+        }
+      }
+      for (auto &tmpl : templates) {
+        Parser::link_includes(*tmpl, storage);
+      }
+      if (parser_config.max_inlined_include_size > 0) {
+        // included templates first, so a partial whose includes were all inlined is inlined itself
+        std::map<std::string, size_t> indices;
+        for (size_t i = 0; i < filenames.size(); ++i) {
+          indices[directory + filenames[i]] = i;
+        }
+        std::vector<bool> visited(templates.size());
+        std::function<void(size_t)> inline_includes = [&](size_t i) {
+          if (visited[i]) {
+            return;
+          }
+          visited[i] = true;
+          for (auto &include : templates[i]->includes) {
+            auto it = indices.find(include);
+            if (it != indices.end()) {
+              inline_includes(it->second);
+            }
+          }
+          Optimizer(*templates[i], function_storage).inline_includes(parser_config.max_inlined_include_size);
+          Parser::compile(*templates[i]);
+        };
+        for (size_t i = 0; i < templates.size(); ++i) {
+          inline_includes(i);
+        }
+      }
+    });
+  }
+
+  /// Returns the template stored under name, or nullptr
+  std::shared_ptr<const Template> find_template(const std::string &name) const {
+    auto templates = template_storage.snapshot();
+    auto it = templates->find(name);
+    return it != templates->end() ? it->second : nullptr;
+  }
+
+  /** Reparses the stored templates whose file changed since it was loaded,
+   * together with the templates that include them, and publishes them at
+   * once. Renders keep using the previous versions until they finish.
+   * A template that fails to parse keeps its previous version, and so do
+   * the templates that include it; the others are still published, then the
+   * first error is rethrown. Returns the number of reparsed templates.
+   */
+  size_t reload_changed_templates() {
+    auto templates = template_storage.snapshot();
+
+    std::set<std::string> changed;
+    std::map<std::string, std::vector<std::string>> included_by;
+    for (auto &entry : *templates) {
+      auto &tmpl = *entry.second;
+      struct stat st;
+      if (!tmpl.filename.empty() && ::stat(tmpl.filename.c_str(), &st) == 0 &&
+          (MappedFile::modification_time(st) != tmpl.modified || static_cast<size_t>(st.st_size) != tmpl.content.size())) {
+        changed.insert(entry.first);
+      }
+      for (auto &include : tmpl.includes) {
+        included_by[include].push_back(entry.first);
+      }
+    }
+    if (changed.empty()) {
+      return 0;
+    }
+
+    std::vector<std::string> queue(changed.begin(), changed.end());
+    while (!queue.empty()) {
+      auto name = std::move(queue.back());
+      queue.pop_back();
+      for (auto &parent : included_by[name]) {
+        if (changed.insert(parent).second) {
+          queue.push_back(parent);
+        }
+      }
+    }
+
+    // Reparse included templates first, so their includers link and inline the new versions
+    std::vector<std::string> order;
+    std::set<std::string> visited;
+    std::function<void(const std::string &)> visit = [&](const std::string &name) {
+      auto it = templates->find(name);
+      if (!changed.count(name) || !visited.insert(name).second || it == templates->end()) {
+        return;
+      }
+      for (auto &include : it->second->includes) {
+        visit(include);
+      }
+      order.push_back(name);
+    };
+    for (auto &name : changed) {
+      visit(name);
+    }
+
+    std::vector<std::shared_ptr<Template>> reloaded;
+    std::set<std::string> failed;
+    std::exception_ptr error;
+    template_storage.update([&](TemplateStorage &storage) {
+      Parser parser(parser_config, lexer_config, storage, storage, function_storage);
+      for (auto &name : order) {
+        auto it = storage.find(name);
+        if (it == storage.end() || it->second->filename.empty()) {
+          continue;
+        }
+        // includes come first in the order, so a failure reaches every includer
+        auto &includes = it->second->includes;
+        if (std::any_of(includes.begin(), includes.end(), [&](const std::string &include) {
+              return failed.count(include) > 0;
+            })) {
+          failed.insert(name);
+          continue;
+        }
+        try {
+          // read, not mapped: the file may be truncated by an editor while it is copied
+          auto tmpl = Parser::load_template(it->second->filename, false);
+          parser.parse_into_template(*tmpl, tmpl->filename);
+          it->second = tmpl;
+          reloaded.push_back(tmpl);
+        } catch (const std::exception &) {
+          failed.insert(name);
+          if (!error) {
+            error = std::current_exception();
+          }
+        }
+      }
+      // link again, templates that include each other cannot all come first
+      for (auto &tmpl : reloaded) {
+        Parser::link_includes(*tmpl, storage);
+      }
+    });
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return reloaded.size();
   }
 };
 
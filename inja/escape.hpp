@@ -0,0 +1,141 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_ESCAPE_HPP_
+#define INCLUDE_INJA_ESCAPE_HPP_
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <accelerator/Range.h>
+
+#include "config.hpp"
+#include "sink.hpp"
+#include "utils.hpp"
+
+namespace inja {
+
+/// Returns the position of the first byte at or after pos that a JSON string cannot hold as is
+/// ('"', '\\' or a control character), or npos. Checks 32 (AVX2) or 16 (SSE2) bytes at a time.
+inline size_t find_json_special(acc::StringPiece view, size_t pos) {
+  const char *data = view.data();
+  const size_t size = view.size();
+
+#if defined(__AVX2__)
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1f);
+  for (; pos + 32 <= size; pos += 32) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+    // block <= 0x1f (unsigned) if max(block, 0x1f) == 0x1f
+    __m256i match = _mm256_cmpeq_epi8(_mm256_max_epu8(block, control), control);
+    match = _mm256_or_si256(match, _mm256_cmpeq_epi8(block, quote));
+    match = _mm256_or_si256(match, _mm256_cmpeq_epi8(block, backslash));
+    uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+  for (; pos + 16 <= size; pos += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+    __m128i match = _mm_cmpeq_epi8(_mm_max_epu8(block, control), control);
+    match = _mm_or_si128(match, _mm_cmpeq_epi8(block, quote));
+    match = _mm_or_si128(match, _mm_cmpeq_epi8(block, backslash));
+    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; pos < size; ++pos) {
+    unsigned char c = static_cast<unsigned char>(data[pos]);
+    if (c < 0x20 || c == '"' || c == '\\') {
+      return pos;
+    }
+  }
+  return acc::StringPiece::npos;
+}
+
+inline bool is_url_unreserved(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+         c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+/// Returns whether no EscapeMode changes text
+inline bool is_escape_invariant(acc::StringPiece text) {
+  for (char c : text) {
+    if (!is_url_unreserved(c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Writes text escaped for mode; the runs in between escapes are written in one piece
+inline void write_escaped(OutputSink &sink, acc::StringPiece text, EscapeMode mode) {
+  static const char hex[] = "0123456789ABCDEF";
+  size_t start = 0;
+
+  switch (mode) {
+  case EscapeMode::None: {
+    sink.write(text);
+  } return;
+  case EscapeMode::Html:
+  case EscapeMode::Xml: {
+    for (size_t pos; (pos = find_first_of(text, start, "&<>\"'")) != acc::StringPiece::npos; start = pos + 1) {
+      sink.write(text.data() + start, pos - start);
+      switch (text[pos]) {
+      case '&': sink.write("&amp;"); break;
+      case '<': sink.write("&lt;"); break;
+      case '>': sink.write("&gt;"); break;
+      case '"': sink.write("&quot;"); break;
+      default: sink.write(mode == EscapeMode::Html ? "&#39;" : "&apos;"); break;
+      }
+    }
+  } break;
+  case EscapeMode::Json: {
+    for (size_t pos; (pos = find_json_special(text, start)) != acc::StringPiece::npos; start = pos + 1) {
+      sink.write(text.data() + start, pos - start);
+      unsigned char c = static_cast<unsigned char>(text[pos]);
+      switch (c) {
+      case '"': sink.write("\\\""); break;
+      case '\\': sink.write("\\\\"); break;
+      case '\b': sink.write("\\b"); break;
+      case '\f': sink.write("\\f"); break;
+      case '\n': sink.write("\\n"); break;
+      case '\r': sink.write("\\r"); break;
+      case '\t': sink.write("\\t"); break;
+      default: {
+        char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        sink.write(escaped, sizeof(escaped));
+      }
+      }
+    }
+  } break;
+  case EscapeMode::Url: {
+    for (size_t pos = 0; pos < text.size(); ++pos) {
+      if (!is_url_unreserved(text[pos])) {
+        unsigned char c = static_cast<unsigned char>(text[pos]);
+        char escaped[] = {'%', hex[c >> 4], hex[c & 0xf]};
+        sink.write(text.data() + start, pos - start);
+        sink.write(escaped, sizeof(escaped));
+        start = pos + 1;
+      }
+    }
+  } break;
+  }
+  sink.write(text.data() + start, text.size() - start);
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_ESCAPE_HPP_
@@ -0,0 +1,161 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_FILE_HPP_
+#define INCLUDE_INJA_FILE_HPP_
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <accelerator/Range.h>
+
+#include "exceptions.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A file mapped read-only into memory.
+ *
+ * Small files, where mmap() costs more than a copy, and files that cannot
+ * be mapped, like pipes, are read into memory instead. Reading a mapping
+ * raises SIGBUS if the file is truncated meanwhile, so files that may be
+ * rewritten while they are loaded, like edited templates, should be read.
+ */
+class MappedFile {
+  static constexpr off_t min_mapping_size {64 * 1024};
+
+  void *mapping {MAP_FAILED};
+  size_t length {0};
+  std::string buffer;
+  int64_t modified {0};
+
+public:
+  explicit MappedFile(const std::string &path, bool may_map = true) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      throw FileError("failed accessing file at '" + path + "'");
+    }
+    modified = modification_time(st);
+
+    if (may_map && S_ISREG(st.st_mode) && st.st_size >= min_mapping_size) {
+      length = static_cast<size_t>(st.st_size);
+      mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (mapping != MAP_FAILED) {
+      ::madvise(mapping, length, MADV_SEQUENTIAL);
+    } else {
+      length = 0;
+      if (S_ISREG(st.st_mode)) {
+        buffer.reserve(static_cast<size_t>(st.st_size));
+      }
+      char chunk[16384];
+      ssize_t n;
+      while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+        buffer.append(chunk, static_cast<size_t>(n));
+      }
+      if (n < 0) {
+        ::close(fd);
+        throw FileError("failed reading file at '" + path + "'");
+      }
+    }
+    ::close(fd);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (mapping != MAP_FAILED) {
+      ::munmap(mapping, length);
+    }
+  }
+
+  /// Nanoseconds since the epoch of the last modification when the file was opened
+  int64_t modification_time() const {
+    return modified;
+  }
+
+  static int64_t modification_time(const struct stat &st) {
+#ifdef __linux__
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#else
+    return static_cast<int64_t>(st.st_mtime) * 1000000000;
+#endif
+  }
+
+  acc::StringPiece data() const {
+    if (mapping != MAP_FAILED) {
+      return acc::StringPiece(static_cast<const char *>(mapping), length);
+    }
+    return buffer;
+  }
+
+  /// Returns the content as a string, a file that was read gives up its buffer instead of copying it
+  std::string release() {
+    if (mapping != MAP_FAILED) {
+      return std::string(static_cast<const char *>(mapping), length);
+    }
+    return std::move(buffer);
+  }
+};
+
+/// Returns the content of a file, copied out of its mapping in one go or read into the result
+inline std::string load_file(const std::string &path) {
+  MappedFile file(path);
+  return file.release();
+}
+
+/// Appends the files below directory whose name matches the glob pattern, relative to directory
+inline void list_files(const std::string &directory, const std::string &pattern,
+                       std::vector<std::string> &result, const std::string &prefix = "") {
+  DIR *dir = ::opendir((directory + prefix).c_str());
+  if (dir == nullptr) {
+    throw FileError("failed accessing directory at '" + directory + prefix + "'");
+  }
+  std::vector<std::string> subdirectories;
+  while (struct dirent *entry = ::readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    bool is_directory = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+      struct stat st;
+      is_directory = ::stat((directory + prefix + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    if (is_directory) {
+      subdirectories.push_back(prefix + name + "/");
+    } else if (::fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+      result.push_back(prefix + name);
+    }
+  }
+  ::closedir(dir);
+
+  for (auto &subdirectory : subdirectories) {
+    list_files(directory, pattern, result, subdirectory);
+  }
+}
+
+inline std::vector<std::string> list_files(const std::string &directory, const std::string &pattern) {
+  std::vector<std::string> result;
+  list_files(directory, pattern, result);
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_FILE_HPP_
@@ -0,0 +1,86 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_FORMAT_HPP_
+#define INCLUDE_INJA_FORMAT_HPP_
+
+#include <cmath>
+#include <cstdint>
+
+#include <accelerator/Range.h>
+
+#include "nlohmann/json.hpp"
+
+namespace inja {
+
+/// Writes the decimal digits of value so that they end at end, returns where they start
+inline char *format_uint(char *end, uint64_t value) {
+  static const char digit_pairs[] =
+      "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+      "8081828384858687888990919293949596979899";
+  while (value >= 100) {
+    size_t i = static_cast<size_t>(value % 100) * 2;
+    value /= 100;
+    *--end = digit_pairs[i + 1];
+    *--end = digit_pairs[i];
+  }
+  if (value >= 10) {
+    size_t i = static_cast<size_t>(value) * 2;
+    *--end = digit_pairs[i + 1];
+    *--end = digit_pairs[i];
+  } else {
+    *--end = static_cast<char>('0' + value);
+  }
+  return end;
+}
+
+/*!
+ * \brief Formats null, booleans and numbers exactly like json::dump(), but into a buffer.
+ *
+ * Integers are written two digits at a time; floats use the shortest
+ * representation that round-trips (Grisu2, the algorithm dump() uses).
+ */
+class ScalarFormatter {
+  char buffer[64];
+
+public:
+  /// Returns the text of value, which is only valid until the next call, or an empty piece if value is no scalar
+  acc::StringPiece format(const nlohmann::json &value) {
+    using value_t = nlohmann::json::value_t;
+    char *end = buffer + sizeof(buffer);
+
+    switch (value.type()) {
+    case value_t::null:
+      return "null";
+    case value_t::boolean:
+      return value.get<bool>() ? "true" : "false";
+    case value_t::number_unsigned: {
+      char *begin = format_uint(end, value.get<nlohmann::json::number_unsigned_t>());
+      return acc::StringPiece(begin, end);
+    }
+    case value_t::number_integer: {
+      auto number = value.get<nlohmann::json::number_integer_t>();
+      uint64_t magnitude = number < 0 ? 0 - static_cast<uint64_t>(number) : static_cast<uint64_t>(number);
+      char *begin = format_uint(end, magnitude);
+      if (number < 0) {
+        *--begin = '-';
+      }
+      return acc::StringPiece(begin, end);
+    }
+    case value_t::number_float: {
+      auto number = value.get<nlohmann::json::number_float_t>();
+      if (!std::isfinite(number)) {
+        return "null";
+      }
+      end = nlohmann::detail::to_chars(buffer, buffer + sizeof(buffer), number);
+      return acc::StringPiece(buffer, end);
+    }
+    default:
+      return acc::StringPiece();
+    }
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_FORMAT_HPP_
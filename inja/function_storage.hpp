@@ -3,6 +3,10 @@
 #ifndef INCLUDE_INJA_FUNCTION_STORAGE_HPP_
 #define INCLUDE_INJA_FUNCTION_STORAGE_HPP_
 
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <accelerator/Range.h>
@@ -18,6 +22,10 @@ using CallbackFunction = std::function<json(Arguments &args)>;
 
 /*!
  * \brief Class for builtin functions and user-defined callbacks.
+ *
+ * Functions are kept in an open-addressing hash table by name, with all
+ * overloads of a name in one slot, so a lookup is one probe sequence and
+ * needs no std::string.
  */
 class FunctionStorage {
 public:
@@ -62,6 +70,7 @@ public:
     Odd,
     Range,
     Round,
+    Safe,
     Sort,
     Upper,
     Callback,
@@ -75,62 +84,140 @@ public:
   struct FunctionData {
     Operation operation;
 
-    CallbackFunction callback;
+    // shared with the FunctionNodes resolved to it, so parsing never copies the callable
+    std::shared_ptr<const CallbackFunction> callback;
   };
 
-  std::map<std::pair<std::string, int>, FunctionData> function_storage = {
-    {std::make_pair("at", 2), FunctionData { Operation::At }},
-    {std::make_pair("default", 2), FunctionData { Operation::Default }},
-    {std::make_pair("divisibleBy", 2), FunctionData { Operation::DivisibleBy }},
-    {std::make_pair("even", 1), FunctionData { Operation::Even }},
-    {std::make_pair("exists", 1), FunctionData { Operation::Exists }},
-    {std::make_pair("existsIn", 2), FunctionData { Operation::ExistsInObject }},
-    {std::make_pair("first", 1), FunctionData { Operation::First }},
-    {std::make_pair("float", 1), FunctionData { Operation::Float }},
-    {std::make_pair("int", 1), FunctionData { Operation::Int }},
-    {std::make_pair("isArray", 1), FunctionData { Operation::IsArray }},
-    {std::make_pair("isBoolean", 1), FunctionData { Operation::IsBoolean }},
-    {std::make_pair("isFloat", 1), FunctionData { Operation::IsFloat }},
-    {std::make_pair("isInteger", 1), FunctionData { Operation::IsInteger }},
-    {std::make_pair("isNumber", 1), FunctionData { Operation::IsNumber }},
-    {std::make_pair("isObject", 1), FunctionData { Operation::IsObject }},
-    {std::make_pair("isString", 1), FunctionData { Operation::IsString }},
-    {std::make_pair("last", 1), FunctionData { Operation::Last }},
-    {std::make_pair("length", 1), FunctionData { Operation::Length }},
-    {std::make_pair("lower", 1), FunctionData { Operation::Lower }},
-    {std::make_pair("max", 1), FunctionData { Operation::Max }},
-    {std::make_pair("min", 1), FunctionData { Operation::Min }},
-    {std::make_pair("odd", 1), FunctionData { Operation::Odd }},
-    {std::make_pair("range", 1), FunctionData { Operation::Range }},
-    {std::make_pair("round", 2), FunctionData { Operation::Round }},
-    {std::make_pair("sort", 1), FunctionData { Operation::Sort }},
-    {std::make_pair("upper", 1), FunctionData { Operation::Upper }},
+private:
+  struct Overload {
+    int num_args;
+    FunctionData data;
   };
 
+  // A slot of the open-addressing table, free if it has no overloads
+  struct Entry {
+    std::string name;
+    std::vector<Overload> overloads;
+  };
+
+  std::vector<Entry> entries;
+  size_t used {0};
+
+  static size_t hash(acc::StringPiece name) {
+    // FNV-1a, names are short
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (char c : name) {
+      h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ULL;
+    }
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+
+  size_t find_slot(const std::vector<Entry> &table, acc::StringPiece name) const {
+    size_t mask = table.size() - 1;
+    size_t i = hash(name) & mask;
+    while (!table[i].overloads.empty() && acc::StringPiece(table[i].name) != name) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  void grow() {
+    std::vector<Entry> table(entries.empty() ? 64 : entries.size() * 2);
+    for (auto &entry : entries) {
+      if (!entry.overloads.empty()) {
+        table[find_slot(table, entry.name)] = std::move(entry);
+      }
+    }
+    entries.swap(table);
+  }
+
+  void add(acc::StringPiece name, int num_args, FunctionData data, bool replace) {
+    if ((used + 1) * 4 > entries.size() * 3) {
+      grow();
+    }
+    auto &entry = entries[find_slot(entries, name)];
+    if (entry.overloads.empty()) {
+      entry.name = name.str();
+      used += 1;
+    }
+    for (auto &overload : entry.overloads) {
+      if (overload.num_args == num_args) {
+        if (replace) {
+          overload.data = std::move(data);
+        }
+        return;
+      }
+    }
+    entry.overloads.push_back(Overload {num_args, std::move(data)});
+  }
+
 public:
+  FunctionStorage() {
+    add_builtin("at", 2, Operation::At);
+    add_builtin("default", 2, Operation::Default);
+    add_builtin("divisibleBy", 2, Operation::DivisibleBy);
+    add_builtin("even", 1, Operation::Even);
+    add_builtin("exists", 1, Operation::Exists);
+    add_builtin("existsIn", 2, Operation::ExistsInObject);
+    add_builtin("first", 1, Operation::First);
+    add_builtin("float", 1, Operation::Float);
+    add_builtin("int", 1, Operation::Int);
+    add_builtin("isArray", 1, Operation::IsArray);
+    add_builtin("isBoolean", 1, Operation::IsBoolean);
+    add_builtin("isFloat", 1, Operation::IsFloat);
+    add_builtin("isInteger", 1, Operation::IsInteger);
+    add_builtin("isNumber", 1, Operation::IsNumber);
+    add_builtin("isObject", 1, Operation::IsObject);
+    add_builtin("isString", 1, Operation::IsString);
+    add_builtin("last", 1, Operation::Last);
+    add_builtin("length", 1, Operation::Length);
+    add_builtin("lower", 1, Operation::Lower);
+    add_builtin("max", 1, Operation::Max);
+    add_builtin("min", 1, Operation::Min);
+    add_builtin("odd", 1, Operation::Odd);
+    add_builtin("range", 1, Operation::Range);
+    add_builtin("round", 2, Operation::Round);
+    add_builtin("safe", 1, Operation::Safe);
+    add_builtin("sort", 1, Operation::Sort);
+    add_builtin("upper", 1, Operation::Upper);
+  }
+
+  /// Adds a builtin, unless a function with this name and number of arguments exists
   void add_builtin(acc::StringPiece name, int num_args, Operation op) {
-    function_storage.emplace(std::make_pair(name.str(), num_args), FunctionData { op });
+    add(name, num_args, FunctionData { op }, false);
   }
 
+  /// Adds a callback, which replaces a builtin or callback with the same name and number of arguments
   void add_callback(acc::StringPiece name, int num_args, const CallbackFunction &callback) {
-    function_storage.emplace(std::make_pair(name.str(), num_args), FunctionData { Operation::Callback, callback });
+    add(name, num_args, FunctionData { Operation::Callback, std::make_shared<const CallbackFunction>(callback) }, true);
   }
 
+  /// Finds the function with the given number of arguments, or else a variadic one of that name
   FunctionData find_function(acc::StringPiece name, int num_args) const {
-    auto it = function_storage.find(std::make_pair(name.str(), num_args));
-    if (it != function_storage.end()) {
-      return it->second;
-
-    // Find variadic function
-    } else if (num_args > 0) {
-      it = function_storage.find(std::make_pair(name.str(), VARIADIC));
-      if (it != function_storage.end()) {
-        return it->second;
+    const auto &entry = entries[find_slot(entries, name)];
+    const FunctionData *variadic {nullptr};
+    for (auto &overload : entry.overloads) {
+      if (overload.num_args == num_args) {
+        return overload.data;
+      }
+      if (overload.num_args == VARIADIC && num_args > 0) {
+        variadic = &overload.data;
       }
     }
-
+    if (variadic) {
+      return *variadic;
+    }
     return { Operation::None };
   }
+
+  /// Returns the callback without arguments that a variable of this name falls back to
+  std::shared_ptr<const CallbackFunction> find_variable_callback(acc::StringPiece name) const {
+    auto function_data = find_function(name, 0);
+    if (function_data.operation != Operation::Callback) {
+      return nullptr;
+    }
+    return function_data.callback;
+  }
 };
 
 } // namespace inja
@@ -6,10 +6,13 @@
 #include <iostream>
 
 #include "environment.hpp"
+#include "escape.hpp"
 #include "exceptions.hpp"
 #include "parser.hpp"
 #include "renderer.hpp"
+#include "sink.hpp"
 #include "template.hpp"
+#include "watcher.hpp"
 #include "nlohmann/json.hpp"
 
 #endif // INCLUDE_INJA_INJA_HPP_
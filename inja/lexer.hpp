@@ -292,13 +292,13 @@ public:
     default:
     case State::Text: {
       // fast-scan to first open character
-      size_t open_start = m_in.subpiece(pos).find_first_of(config.open_chars);
+      size_t open_start = inja::find_first_of(m_in, pos, config.open_chars);
       if (open_start == acc::StringPiece::npos) {
         // didn't find open, return remaining text as text token
         pos = m_in.size();
         return make_token(Token::Kind::Text);
       }
-      pos += open_start;
+      pos = open_start;
 
       // try to match one of the opening sequences, and get the close
       acc::StringPiece open_str = m_in.subpiece(pos);
@@ -3,8 +3,10 @@
 #ifndef INCLUDE_INJA_NODE_HPP_
 #define INCLUDE_INJA_NODE_HPP_
 
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "function_storage.hpp"
 #include "nlohmann/json.hpp"
@@ -26,6 +28,7 @@ class ForObjectStatementNode;
 class IfStatementNode;
 class IncludeStatementNode;
 
+struct Template;
 
 class NodeVisitor {
 public:
@@ -71,9 +74,32 @@ public:
 
 class TextNode : public AstNode {
 public:
-  std::string content;
+  // view of [pos, pos + length) in Template::content, unless joined is set
+  size_t length;
+  // owned text of fragments that are not adjacent in the source
+  std::string joined;
 
-  explicit TextNode(acc::StringPiece content, size_t pos): AstNode(pos), content(content.str()) { }
+  explicit TextNode(size_t pos, size_t length): AstNode(pos), length(length) { }
+
+  acc::StringPiece text(const std::string& content) const {
+    if (!joined.empty()) {
+      return joined;
+    }
+    return acc::StringPiece(content.data() + pos, length);
+  }
+
+  /// Appends the following text fragment of the same block
+  void append(const std::string& content, acc::StringPiece fragment) {
+    if (joined.empty() && fragment.data() == content.data() + pos + length) {
+      length += fragment.size();
+      return;
+    }
+    if (joined.empty()) {
+      joined.assign(content, pos, length);
+    }
+    joined.append(fragment.data(), fragment.size());
+    length = joined.size();
+  }
 
   void accept(NodeVisitor& v) const {
     v.visit(*this);
@@ -102,21 +128,66 @@ public:
 
 class JsonNode : public ExpressionNode {
 public:
+  struct PathPart {
+    std::string key;
+    size_t index; // array index, npos if key is not a valid one
+  };
+
   std::string name;
-  std::string ptr {""};
+  std::vector<PathPart> path;
+  // zero-argument callback of the same name, called if the variable is not in the data
+  std::shared_ptr<const CallbackFunction> callback;
 
   explicit JsonNode(acc::StringPiece ptr_name, size_t pos) : ExpressionNode(pos), name(ptr_name.str()) {
-    // Convert dot notation to json pointer notation
-    do {
-      acc::StringPiece part = ptr_name.split_step('.');
-      ptr.push_back('/');
-      ptr.append(part.begin(), part.end());
-    } while (!ptr_name.empty());
+    // Split dot (or json pointer) notation into its parts once
+    size_t start = 0;
+    for (size_t i = 0; i <= name.size(); ++i) {
+      if (i == name.size() || name[i] == '.' || name[i] == '/') {
+        std::string key = name.substr(start, i - start);
+        path.push_back(PathPart {key, parse_index(key)});
+        start = i + 1;
+      }
+    }
+  }
+
+  /// Walk the path (from part start on) through data, returns nullptr if it does not exist
+  const nlohmann::json* find(const nlohmann::json& data, size_t start = 0) const {
+    const nlohmann::json* result = &data;
+    for (size_t i = start; i < path.size(); ++i) {
+      auto& part = path[i];
+      if (result->is_object()) {
+        auto it = result->find(part.key);
+        if (it == result->end()) {
+          return nullptr;
+        }
+        result = &*it;
+      } else if (result->is_array() && part.index < result->size()) {
+        result = &(*result)[part.index];
+      } else {
+        return nullptr;
+      }
+    }
+    return result;
   }
 
   void accept(NodeVisitor& v) const {
     v.visit(*this);
   }
+
+private:
+  static size_t parse_index(const std::string& key) {
+    if (key.empty() || (key[0] == '0' && key.size() > 1)) {
+      return std::string::npos;
+    }
+    size_t index = 0;
+    for (char c : key) {
+      if (c < '0' || c > '9') {
+        return std::string::npos;
+      }
+      index = index * 10 + (c - '0');
+    }
+    return index;
+  }
 };
 
 class FunctionNode : public ExpressionNode {
@@ -135,7 +206,7 @@ public:
 
   std::string name;
   size_t number_args;
-  CallbackFunction callback;
+  std::shared_ptr<const CallbackFunction> callback;
 
   explicit FunctionNode(acc::StringPiece name, size_t pos) : ExpressionNode(pos), precedence(5), associativity(Associativity::Left), operation(Op::Callback), name(name.str()), number_args(1) { }
   explicit FunctionNode(Op operation, size_t pos) : ExpressionNode(pos), operation(operation), number_args(1) {
@@ -211,6 +282,14 @@ public:
     }
   }
 
+  /// Number of operands the function takes from the stack
+  size_t arity() const {
+    if (!name.empty()) {
+      return number_args;
+    }
+    return operation == Op::Not ? 1 : 2;
+  }
+
   void accept(NodeVisitor& v) const {
     v.visit(*this);
   }
@@ -248,9 +327,9 @@ public:
 
 class ForArrayStatementNode : public ForStatementNode {
 public:
-  acc::StringPiece value;
+  std::string value;
 
-  explicit ForArrayStatementNode(acc::StringPiece value, size_t pos) : ForStatementNode(pos), value(value) { }
+  explicit ForArrayStatementNode(acc::StringPiece value, size_t pos) : ForStatementNode(pos), value(value.str()) { }
 
   void accept(NodeVisitor& v) const {
     v.visit(*this);
@@ -259,10 +338,10 @@ public:
 
 class ForObjectStatementNode : public ForStatementNode {
 public:
-  acc::StringPiece key;
-  acc::StringPiece value;
+  std::string key;
+  std::string value;
 
-  explicit ForObjectStatementNode(acc::StringPiece key, acc::StringPiece value, size_t pos) : ForStatementNode(pos), key(key), value(value) { }
+  explicit ForObjectStatementNode(acc::StringPiece key, acc::StringPiece value, size_t pos) : ForStatementNode(pos), key(key.str()), value(value.str()) { }
 
   void accept(NodeVisitor& v) const {
     v.visit(*this);
@@ -290,6 +369,9 @@ public:
 class IncludeStatementNode : public StatementNode {
 public:
   std::string file;
+  // the included template, linked by the parser if it is known then; weak,
+  // so recursive includes leak nothing and a replaced template expires
+  std::weak_ptr<const Template> included;
 
   explicit IncludeStatementNode(const std::string& file, size_t pos) : StatementNode(pos), file(file) { }
 
@@ -0,0 +1,121 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_NUMBER_HPP_
+#define INCLUDE_INJA_NUMBER_HPP_
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "nlohmann/json.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A number read out of a json as it is stored: an int64 or a double.
+ *
+ * Integer operations stay exact in 64 bits and switch to double where they
+ * would overflow, instead of truncating to int.
+ */
+struct Number {
+  using json = nlohmann::json;
+
+  bool is_integer {false};
+  int64_t integer {0};
+  double floating {0};
+
+  Number() = default;
+
+  explicit Number(int64_t value) : is_integer(true), integer(value) { }
+
+  explicit Number(double value) : floating(value) { }
+
+  /// Throws json::type_error if value is neither a number nor a boolean, like json::get<double>()
+  explicit Number(const json &value) {
+    switch (value.type()) {
+    case json::value_t::number_integer:
+      is_integer = true;
+      integer = value.get_ref<const json::number_integer_t &>();
+      break;
+    case json::value_t::number_unsigned: {
+      auto number = value.get_ref<const json::number_unsigned_t &>();
+      if (number <= static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+        is_integer = true;
+        integer = static_cast<int64_t>(number);
+      } else {
+        floating = static_cast<double>(number);
+      }
+    } break;
+    case json::value_t::number_float:
+      floating = value.get_ref<const json::number_float_t &>();
+      break;
+    default:
+      floating = value.get<double>();
+      break;
+    }
+  }
+
+  double to_double() const {
+    return is_integer ? static_cast<double>(integer) : floating;
+  }
+
+  /// Truncates floats toward zero
+  int64_t to_integer() const {
+    return is_integer ? integer : static_cast<int64_t>(floating);
+  }
+
+  friend Number operator+(const Number &a, const Number &b) {
+    int64_t result;
+    if (a.is_integer && b.is_integer && !__builtin_add_overflow(a.integer, b.integer, &result)) {
+      return Number(result);
+    }
+    return Number(a.to_double() + b.to_double());
+  }
+
+  friend Number operator-(const Number &a, const Number &b) {
+    int64_t result;
+    if (a.is_integer && b.is_integer && !__builtin_sub_overflow(a.integer, b.integer, &result)) {
+      return Number(result);
+    }
+    return Number(a.to_double() - b.to_double());
+  }
+
+  friend Number operator*(const Number &a, const Number &b) {
+    int64_t result;
+    if (a.is_integer && b.is_integer && !__builtin_mul_overflow(a.integer, b.integer, &result)) {
+      return Number(result);
+    }
+    return Number(a.to_double() * b.to_double());
+  }
+
+  /// Exact by squaring for integers with a non-negative exponent, std::pow otherwise
+  static Number pow(const Number &base, const Number &exponent) {
+    if (base.is_integer && exponent.is_integer && exponent.integer >= 0) {
+      int64_t result = 1;
+      int64_t factor = base.integer;
+      bool overflow = false;
+      for (int64_t e = exponent.integer; e > 0 && !overflow; e >>= 1) {
+        if (e & 1) {
+          overflow = __builtin_mul_overflow(result, factor, &result);
+        }
+        if (e > 1 && !overflow) {
+          overflow = __builtin_mul_overflow(factor, factor, &factor);
+        }
+      }
+      if (!overflow) {
+        return Number(result);
+      }
+    }
+    return Number(std::pow(base.to_double(), exponent.to_double()));
+  }
+
+  /// Remainder of the integer parts, divisor must not be zero
+  static int64_t remainder(int64_t dividend, int64_t divisor) {
+    // INT64_MIN % -1 overflows
+    return divisor == -1 ? 0 : dividend % divisor;
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_NUMBER_HPP_
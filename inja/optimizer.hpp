@@ -0,0 +1,303 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_OPTIMIZER_HPP_
+#define INCLUDE_INJA_OPTIMIZER_HPP_
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "compiler.hpp"
+#include "config.hpp"
+#include "escape.hpp"
+#include "function_storage.hpp"
+#include "node.hpp"
+#include "renderer.hpp"
+#include "serializer.hpp"
+#include "sink.hpp"
+#include "template.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A pass over the AST of a Template that does work once instead of per render.
+ *
+ * Builtin calls whose arguments are all constant are evaluated with the
+ * Renderer and replaced by a literal, if branches with a constant condition
+ * are replaced by the branch that runs, and constant expressions that no
+ * escape mode changes (or that are safe()) are printed into text that is
+ * merged with its neighbours.
+ *
+ * Given static data, variables found in it are treated as constants too,
+ * except for the names of enclosing loop variables, and so is exists() of
+ * the names in it. Includes of small
+ * templates can be replaced by a copy of their AST before that.
+ */
+class Optimizer {
+  using Op = FunctionStorage::Operation;
+
+  Template &tmpl;
+  const FunctionStorage &function_storage;
+  const json *static_data;
+  const TemplateStorage no_templates;
+  Renderer renderer;
+
+  // names that refer to loop variables in the current block
+  std::vector<std::string> loop_names;
+
+  static bool is_pure(Op operation) {
+    switch (operation) {
+    case Op::Callback:  // user code
+    case Op::Exists:    // looks up the input
+    case Op::Range:     // may build a huge array
+    case Op::Safe:      // marks the printed value
+    case Op::ParenLeft:
+    case Op::ParenRight:
+    case Op::None:
+      return false;
+    default:
+      return true;
+    }
+  }
+
+  /// Replaces the constant calls in an expression by their value
+  void fold(ExpressionListNode& expression) {
+    struct Operand {
+      size_t start;   // first node of the operand in output
+      bool constant;
+    };
+    std::vector<Operand> operands;
+    std::vector<std::shared_ptr<ExpressionNode>> output;
+
+    for (auto& node : expression.rpn_output) {
+      Operand operand {output.size(), false};
+      output.push_back(node);
+
+      if (auto literal = std::dynamic_pointer_cast<LiteralNode>(node)) {
+        operand.constant = true;
+      } else if (auto variable = std::dynamic_pointer_cast<JsonNode>(node)) {
+        if (auto value = find_static(*variable)) {
+          output.back() = std::make_shared<LiteralNode>(*value, variable->pos);
+          operand.constant = true;
+        }
+      } else if (auto function = std::dynamic_pointer_cast<FunctionNode>(node)) {
+        size_t args = function->arity();
+        if (args > operands.size()) {
+          return;  // malformed, left for the renderer to report
+        }
+        operand.constant = is_pure(function->operation);
+        for (size_t i = 0; i < args; ++i) {
+          operand.start = operands.back().start;
+          operand.constant = operand.constant && operands.back().constant;
+          operands.pop_back();
+        }
+        if (function->operation == Op::Exists) {
+          operand.constant = fold_exists(output, operand.start, function->pos);
+        } else if (operand.constant && operand.start + 1 < output.size()) {
+          operand.constant = fold(output, operand.start, function->pos);
+        }
+      }
+      operands.push_back(operand);
+    }
+    expression.rpn_output = std::move(output);
+  }
+
+  /// Evaluates the nodes of output from start on, returns false if that fails
+  bool fold(std::vector<std::shared_ptr<ExpressionNode>>& output, size_t start, size_t pos) {
+    ExpressionListNode constant(pos);
+    constant.rpn_output.assign(output.begin() + start, output.end());
+    try {
+      auto value = renderer.evaluate(tmpl, Compiler().compile(constant));
+      output.resize(start);
+      output.push_back(std::make_shared<LiteralNode>(value, pos));
+      return true;
+    } catch (const std::exception&) {
+      // e.g. a type error, which the renderer reports with its location
+      return false;
+    }
+  }
+
+  /// Replaces exists() of a name in the static data by true; other names may still be in the data of a render
+  bool fold_exists(std::vector<std::shared_ptr<ExpressionNode>>& output, size_t start, size_t pos) {
+    if (!static_data || !static_data->is_object() || start + 2 != output.size()) {
+      return false;
+    }
+    auto name = std::dynamic_pointer_cast<LiteralNode>(output[start]);
+    if (!name || !name->value.is_string() || static_data->find(name->value.get_ref<const std::string&>()) == static_data->end()) {
+      return false;
+    }
+    output.resize(start);
+    output.push_back(std::make_shared<LiteralNode>(json(true), pos));
+    return true;
+  }
+
+  const json* find_static(const JsonNode& variable) const {
+    if (!static_data) {
+      return nullptr;
+    }
+    const auto& name = variable.path[0].key;
+    if (std::find(loop_names.begin(), loop_names.end(), name) != loop_names.end()) {
+      return nullptr;
+    }
+    return variable.find(*static_data);
+  }
+
+  static std::shared_ptr<LiteralNode> constant_value(const ExpressionListNode& expression) {
+    if (expression.rpn_output.size() != 1) {
+      return nullptr;
+    }
+    return std::dynamic_pointer_cast<LiteralNode>(expression.rpn_output.front());
+  }
+
+  void append_text(std::vector<std::shared_ptr<AstNode>>& nodes, const std::shared_ptr<TextNode>& text) {
+    auto previous = nodes.empty() ? nullptr : std::dynamic_pointer_cast<TextNode>(nodes.back());
+    if (previous) {
+      previous->append(tmpl.content, text->text(tmpl.content));
+    } else {
+      nodes.push_back(text);
+    }
+  }
+
+  void append(std::vector<std::shared_ptr<AstNode>>& nodes, const std::shared_ptr<AstNode>& node) {
+    if (auto text = std::dynamic_pointer_cast<TextNode>(node)) {
+      append_text(nodes, text);
+    } else {
+      nodes.push_back(node);
+    }
+  }
+
+  void optimize(BlockNode& block) {
+    std::vector<std::shared_ptr<AstNode>> nodes;
+
+    for (auto& node : block.nodes) {
+      if (auto expression = std::dynamic_pointer_cast<ExpressionListNode>(node)) {
+        fold(*expression);
+        bool is_safe = Compiler::is_safe(*expression);
+        auto literal = is_safe && expression->rpn_output.size() == 2
+                       ? std::dynamic_pointer_cast<LiteralNode>(expression->rpn_output.front())
+                       : constant_value(*expression);
+        if (!literal) {
+          nodes.push_back(node);
+          continue;
+        }
+        std::string printed;
+        StringSink sink(printed);
+        Renderer::write_json(sink, literal->value);
+        if (!is_safe && !is_escape_invariant(printed)) {
+          // the escape mode is only known when rendering
+          nodes.push_back(node);
+          continue;
+        }
+        if (!printed.empty()) {
+          auto text = std::make_shared<TextNode>(expression->pos, printed.size());
+          text->joined = std::move(printed);
+          append_text(nodes, text);
+        }
+
+      } else if (auto if_statement = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        fold(if_statement->condition);
+        optimize(if_statement->true_statement);
+        optimize(if_statement->false_statement);
+        auto literal = constant_value(if_statement->condition);
+        bool is_known = false;
+        bool condition = false;
+        if (literal) {
+          try {
+            condition = Renderer::truthy(&literal->value);
+            is_known = true;
+          } catch (const std::exception&) { }
+        }
+        if (!is_known) {
+          nodes.push_back(node);
+          continue;
+        }
+        for (auto& n : (condition ? if_statement->true_statement : if_statement->false_statement).nodes) {
+          append(nodes, n);
+        }
+
+      } else if (auto for_statement = std::dynamic_pointer_cast<ForStatementNode>(node)) {
+        fold(for_statement->condition);
+        size_t outer_names = loop_names.size();
+        loop_names.push_back("loop");
+        if (auto for_array = std::dynamic_pointer_cast<ForArrayStatementNode>(node)) {
+          loop_names.push_back(for_array->value);
+        } else if (auto for_object = std::dynamic_pointer_cast<ForObjectStatementNode>(node)) {
+          loop_names.push_back(for_object->key);
+          loop_names.push_back(for_object->value);
+        }
+        optimize(for_statement->body);
+        loop_names.resize(outer_names);
+        nodes.push_back(node);
+
+      } else {
+        append(nodes, node);
+      }
+    }
+
+    block.nodes = std::move(nodes);
+  }
+
+  static bool is_inlinable(const Template& included, size_t max_size) {
+    // a template that is still being parsed has no bytecode yet
+    if (included.bytecodes.empty() || included.bytecodes.size() > max_size) {
+      return false;
+    }
+    // only leaves, which also rules out recursion
+    return std::none_of(included.bytecodes.begin(), included.bytecodes.end(), [](const Bytecode& bc) {
+      return bc.op == Bytecode::Op::Include;
+    });
+  }
+
+  bool inline_includes(BlockNode& block, size_t max_size) {
+    bool inlined = false;
+    std::vector<std::shared_ptr<AstNode>> nodes;
+
+    for (auto& node : block.nodes) {
+      if (auto include = std::dynamic_pointer_cast<IncludeStatementNode>(node)) {
+        auto included = include->included.lock();
+        if (included && is_inlinable(*included, max_size)) {
+          // a copy, placed at the include for error messages
+          std::string ast;
+          AstWriter(ast).write(included->root);
+          BlockNode copy;
+          if (AstReader(ast, included->content, function_storage).relocate(include->pos).read(copy)) {
+            nodes.insert(nodes.end(), copy.nodes.begin(), copy.nodes.end());
+            inlined = true;
+            continue;
+          }
+        }
+      } else if (auto if_statement = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        inlined |= inline_includes(if_statement->true_statement, max_size);
+        inlined |= inline_includes(if_statement->false_statement, max_size);
+      } else if (auto for_statement = std::dynamic_pointer_cast<ForStatementNode>(node)) {
+        inlined |= inline_includes(for_statement->body, max_size);
+      }
+      nodes.push_back(node);
+    }
+
+    block.nodes = std::move(nodes);
+    return inlined;
+  }
+
+public:
+  explicit Optimizer(Template &tmpl, const FunctionStorage &function_storage, const json *static_data = nullptr)
+      : tmpl(tmpl), function_storage(function_storage), static_data(static_data), renderer(RenderConfig(), no_templates) { }
+
+  void optimize() {
+    optimize(tmpl.root);
+  }
+
+  /// Inlines the linked includes of templates with at most max_size bytecodes, then optimizes again
+  void inline_includes(size_t max_size) {
+    if (inline_includes(tmpl.root, max_size)) {
+      optimize();
+    }
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_OPTIMIZER_HPP_
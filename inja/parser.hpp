@@ -10,11 +10,16 @@
 #include <queue>
 #include <vector>
 
+#include "cache.hpp"
+#include "compiler.hpp"
 #include "config.hpp"
 #include "exceptions.hpp"
+#include "file.hpp"
 #include "function_storage.hpp"
 #include "lexer.hpp"
 #include "node.hpp"
+#include "optimizer.hpp"
+#include "statistics.hpp"
 #include "template.hpp"
 #include "token.hpp"
 #include "utils.hpp"
@@ -29,7 +34,8 @@ class Parser {
   const ParserConfig &config;
 
   Lexer lexer;
-  TemplateStorage &template_storage;
+  const TemplateStorage &template_storage;
+  TemplateStorage &loaded_templates;
   const FunctionStorage &function_storage;
 
   Token tok, peek_tok;
@@ -42,6 +48,7 @@ class Parser {
   acc::StringPiece json_literal_start;
 
   BlockNode *current_block {nullptr};
+  std::shared_ptr<TextNode> last_text_node;
   ExpressionListNode *current_expression_list {nullptr};
   std::stack<std::pair<FunctionNode*, size_t>> function_stack;
 
@@ -149,7 +156,9 @@ class Parser {
 
         // Variables
         } else {
-          current_expression_list->rpn_output.emplace_back(std::make_shared<JsonNode>(tok.text.str(), tok.text.data() - tmpl.content.c_str()));
+          auto variable = std::make_shared<JsonNode>(tok.text.str(), tok.text.data() - tmpl.content.c_str());
+          variable->callback = function_storage.find_variable_callback(variable->name);
+          current_expression_list->rpn_output.emplace_back(variable);
         }
 
       // Operators
@@ -434,10 +443,8 @@ class Parser {
       }
       // sys::path::remove_dots(pathname, true, sys::path::Style::posix);
 
-      if (config.search_included_templates_in_files && template_storage.find(pathname) == template_storage.end()) {
-        auto include_template = Template(load_file(pathname));
-        template_storage.emplace(pathname, include_template);
-        parse_into_template(template_storage[pathname], pathname);
+      if (config.search_included_templates_in_files) {
+        load_included_template(pathname);
       }
 
       current_block->nodes.emplace_back(std::make_shared<IncludeStatementNode>(pathname, tok.text.data() - tmpl.content.c_str()));
@@ -451,6 +458,33 @@ class Parser {
   }
 
   void parse_into(Template &tmpl, acc::StringPiece path) {
+    if (config.cache_directory.empty()) {
+      parse_tokens(tmpl, path);
+    } else {
+      // The cache holds the AST before it is optimized and includes are inlined,
+      // as both depend on the functions and templates of the environment
+      TemplateCache cache(config.cache_directory, tmpl, path, lexer.get_config());
+      if (cache.load(tmpl, function_storage)) {
+        if (config.search_included_templates_in_files) {
+          for_each_include(tmpl.root, [&](IncludeStatementNode& include) {
+            load_included_template(include.file);
+          });
+        }
+      } else {
+        parse_tokens(tmpl, path);
+        cache.store(tmpl);
+      }
+    }
+
+    Optimizer(tmpl, function_storage).optimize();
+    link_includes(tmpl);
+    if (config.max_inlined_include_size > 0) {
+      Optimizer(tmpl, function_storage).inline_includes(config.max_inlined_include_size);
+    }
+    compile(tmpl);
+  }
+
+  void parse_tokens(Template &tmpl, acc::StringPiece path) {
     lexer.start(tmpl.content);
     current_block = &tmpl.root;
 
@@ -466,7 +500,13 @@ class Parser {
         }
       } return;
       case Token::Kind::Text: {
-        current_block->nodes.emplace_back(std::make_shared<TextNode>(tok.text, tok.text.data() - tmpl.content.c_str()));
+        // coalesce text around comments into one node
+        if (!current_block->nodes.empty() && current_block->nodes.back() == last_text_node) {
+          last_text_node->append(tmpl.content, tok.text);
+        } else {
+          last_text_node = std::make_shared<TextNode>(tok.text.data() - tmpl.content.c_str(), tok.text.size());
+          current_block->nodes.emplace_back(last_text_node);
+        }
       } break;
       case Token::Kind::StatementOpen: {
         get_next_token();
@@ -516,9 +556,11 @@ class Parser {
 
 
 public:
-  explicit Parser(const ParserConfig &parser_config, const LexerConfig &lexer_config,
-                  TemplateStorage &template_storage, const FunctionStorage &function_storage)
-      : config(parser_config), lexer(lexer_config), template_storage(template_storage), function_storage(function_storage) { }
+  /// Included templates that are not in template_storage are loaded into loaded_templates, which may be the same map
+  explicit Parser(const ParserConfig &parser_config, const LexerConfig &lexer_config, const TemplateStorage &template_storage,
+                  TemplateStorage &loaded_templates, const FunctionStorage &function_storage)
+      : config(parser_config), lexer(lexer_config), template_storage(template_storage), loaded_templates(loaded_templates),
+        function_storage(function_storage) { }
 
   Template parse(acc::StringPiece input, acc::StringPiece path) {
     auto result = Template(input.str());
@@ -540,15 +582,83 @@ public:
     acc::StringPiece path = filename.subpiece(0, find_last_of(filename) + 1);
 
     // StringRef path = sys::path::parent_path(filename);
-    auto sub_parser = Parser(config, lexer.get_config(), template_storage, function_storage);
+    auto sub_parser = Parser(config, lexer.get_config(), template_storage, loaded_templates, function_storage);
     sub_parser.parse_into(tmpl, path);
   }
 
-  std::string load_file(acc::StringPiece filename) {
-    std::ifstream file;
-    open_file_or_throw(filename.str(), file);
-    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    return text;
+  /// Returns the template stored or loaded under name, or nullptr
+  std::shared_ptr<const Template> find_template(const std::string &name) const {
+    auto loaded = loaded_templates.find(name);
+    if (loaded != loaded_templates.end()) {
+      return loaded->second;
+    }
+    auto stored = template_storage.find(name);
+    return stored != template_storage.end() ? stored->second : nullptr;
+  }
+
+  /// Loads and parses an included template from its file, unless it is stored already
+  void load_included_template(const std::string &pathname) {
+    if (!find_template(pathname)) {
+      auto include_template = load_template(pathname);
+      loaded_templates.emplace(pathname, include_template);
+      parse_into_template(*include_template, pathname);
+    }
+  }
+
+  /// Calls f with each include statement of a block
+  template<typename F>
+  static void for_each_include(BlockNode &block, const F& f) {
+    for (auto& node : block.nodes) {
+      if (auto include = std::dynamic_pointer_cast<IncludeStatementNode>(node)) {
+        f(*include);
+      } else if (auto if_statement = std::dynamic_pointer_cast<IfStatementNode>(node)) {
+        for_each_include(if_statement->true_statement, f);
+        for_each_include(if_statement->false_statement, f);
+      } else if (auto for_statement = std::dynamic_pointer_cast<ForStatementNode>(node)) {
+        for_each_include(for_statement->body, f);
+      }
+    }
+  }
+
+  /// Points the includes of a template to the stored templates they name; it must not be shared yet
+  static void link_includes(Template &tmpl, const TemplateStorage &templates) {
+    for_each_include(tmpl.root, [&](IncludeStatementNode& include) {
+      tmpl.includes.insert(include.file);
+      auto it = templates.find(include.file);
+      if (it != templates.end()) {
+        include.included = it->second;
+      }
+    });
+  }
+
+  /// Points the includes of a template to the templates stored or loaded under their names
+  void link_includes(Template &tmpl) const {
+    for_each_include(tmpl.root, [&](IncludeStatementNode& include) {
+      tmpl.includes.insert(include.file);
+      include.included = find_template(include.file);
+    });
+  }
+
+  /// Lowers the AST of a Template into bytecode and collects its statistics
+  static void compile(Template &tmpl) {
+    tmpl.bytecodes = Compiler().compile(tmpl.root);
+
+    auto statistic_visitor = StatisticsVisitor();
+    tmpl.root.accept(statistic_visitor);
+    tmpl.estimated_output_size = statistic_visitor.estimated_output_size;
+  }
+
+  /// Loads the content of a template file and remembers where it came from
+  static std::shared_ptr<Template> load_template(const std::string &filename, bool may_map = true) {
+    MappedFile file(filename, may_map);
+    auto tmpl = std::make_shared<Template>(file.release());
+    tmpl->filename = filename;
+    tmpl->modified = file.modification_time();
+    return tmpl;
+  }
+
+  static std::string load_file(acc::StringPiece filename) {
+    return inja::load_file(filename.str());
   }
 };
 
@@ -10,9 +10,15 @@
 #include <utility>
 #include <vector>
 
+#include "arena.hpp"
+#include "bytecode.hpp"
 #include "config.hpp"
+#include "escape.hpp"
+#include "format.hpp"
 #include "exceptions.hpp"
 #include "node.hpp"
+#include "number.hpp"
+#include "sink.hpp"
 #include "template.hpp"
 #include "utils.hpp"
 #include "nlohmann/json.hpp"
@@ -22,53 +28,43 @@ namespace inja {
 /*!
  * \brief Class for rendering a Template with data.
  */
-class Renderer : public NodeVisitor  {
+class Renderer {
   using Op = FunctionStorage::Operation;
 
+  struct LoopLevel {
+    const std::string *key_name;   // nullptr for array loops
+    const std::string *value_name;
+    const json *values;
+    json::const_iterator it;
+    size_t index;
+    size_t size;
+    json key;                      // key of the current item in object loops
+    size_t arena_base;             // json_tmp_arena_base of the enclosing scope
+  };
+
   const RenderConfig config;
   const Template *current_template;
   const TemplateStorage &template_storage;
-  const FunctionStorage &function_storage;
 
   const json *json_input;
-  std::ostream *output_stream;
+  const json *static_input {nullptr};  // of a specialized template, looked up first
+  OutputSink *output;
 
-  json json_loop_data;
-  json* current_loop_data = &json_loop_data["loop"];
 
-  std::vector<std::shared_ptr<json>> json_tmp_stack;
+  // Temporaries of the current expression live above json_tmp_arena_base,
+  // the containers of the running loops below it
+  JsonArena json_tmp_arena;
+  size_t json_tmp_arena_base {0};
   std::stack<const json*> json_eval_stack;
   std::stack<const JsonNode*> not_found_stack;
+  std::vector<LoopLevel> loop_stack;
 
-  bool truthy(const json* data) const {
-    if (data->empty()) {
-      return false;
-    } else if (data->is_number()) {
-      return (*data != 0);
-    } else if (data->is_string()) {
-      return !data->empty();
-    }
-
-    try {
-      return data->get<bool>();
-    } catch (json::type_error &e) {
-      throw JsonError(e.what());
-    }
+  void print_json(const json* value, bool is_safe) {
+    write_json(*output, *value, is_safe ? EscapeMode::None : config.escape_mode);
   }
 
-  void print_json(const json* value) {
-    if (value->is_string()) {
-      *output_stream << value->get_ref<const std::string &>();
-    } else {
-      *output_stream << value->dump();
-    }
-  }
-
-  const std::shared_ptr<json> eval_expression_list(const ExpressionListNode& expression_list) {
-    for (auto& expression : expression_list.rpn_output) {
-      expression->accept(*this);
-    }
-
+  /// Pops the value of an expression; it points into the input, the template or json_tmp_arena
+  const json* eval_expression_list(const ExpressionListNode& expression_list) {
     if (json_eval_stack.empty()) {
       throw_renderer_error("empty expression", expression_list);
     }
@@ -90,7 +86,7 @@ class Renderer : public NodeVisitor  {
 
       throw_renderer_error("variable '" + node->name + "' not found", *node);
     }
-    return std::make_shared<json>(*result);
+    return result;
   }
 
   void throw_renderer_error(const std::string &message, const AstNode& node) {
@@ -98,6 +94,11 @@ class Renderer : public NodeVisitor  {
     throw RenderError(message, loc);
   }
 
+  /// Stores the result of an arithmetic operation as a temporary, an integer stays an integer
+  json* make_number(const Number& number) {
+    return number.is_integer ? json_tmp_arena.make(number.integer) : json_tmp_arena.make(number.floating);
+  }
+
   template<size_t N, bool throw_not_found=true>
   std::array<const json*, N> get_arguments(const AstNode& node) {
     if (json_eval_stack.size() < N) {
@@ -140,176 +141,207 @@ class Renderer : public NodeVisitor  {
     return result;
   }
 
-  void visit(const BlockNode& node) {
-    for (auto& n : node.nodes) {
-      n->accept(*this);
+  /// Loop metadata of the given level (and all its parents) as a json object
+  json loop_data(size_t level) const {
+    const auto& loop = loop_stack[level];
+    json result;
+    result["index"] = loop.index;
+    result["index1"] = loop.index + 1;
+    result["is_first"] = (loop.index == 0);
+    result["is_last"] = (loop.index == loop.size - 1);
+    if (level > 0) {
+      result["parent"] = loop_data(level - 1);
     }
+    return result;
   }
 
-  void visit(const TextNode& node) {
-    *output_stream << node.content;
+  const json* find_loop_metadata(const JsonNode& node) {
+    size_t level = loop_stack.size() - 1;
+    size_t i = 1;
+    for (; i < node.path.size() && node.path[i].key == "parent"; ++i) {
+      if (level == 0) {
+        return nullptr;
+      }
+      level -= 1;
+    }
+
+    json* result_ptr {nullptr};
+    if (i == node.path.size()) {
+      result_ptr = json_tmp_arena.make(loop_data(level));
+    } else if (i + 1 == node.path.size()) {
+      const auto& loop = loop_stack[level];
+      const auto& key = node.path[i].key;
+      if (key == "index") {
+        result_ptr = json_tmp_arena.make(loop.index);
+      } else if (key == "index1") {
+        result_ptr = json_tmp_arena.make(loop.index + 1);
+      } else if (key == "is_first") {
+        result_ptr = json_tmp_arena.make(loop.index == 0);
+      } else if (key == "is_last") {
+        result_ptr = json_tmp_arena.make(loop.index == loop.size - 1);
+      }
+    }
+    return result_ptr;
   }
 
-  void visit(const ExpressionNode&) { }
+  const json* find_loop_variable(const JsonNode& node) {
+    if (loop_stack.empty()) {
+      return nullptr;
+    }
 
-  void visit(const LiteralNode& node) {
-    json_eval_stack.push(&node.value);
+    const auto& name = node.path[0].key;
+    if (name == "loop") {
+      return find_loop_metadata(node);
+    }
+    for (auto level = loop_stack.rbegin(); level != loop_stack.rend(); ++level) {
+      if (name == *level->value_name) {
+        return node.find(*level->it, 1);
+      }
+      if (level->key_name && name == *level->key_name) {
+        return node.find(level->key, 1);
+      }
+    }
+    return nullptr;
   }
 
-  void visit(const JsonNode& node) {
-    auto ptr = json::json_pointer(node.ptr);
+  void push_variable(const JsonNode& node) {
+    // First try to evaluate as a loop variable
+    const json* value = find_loop_variable(node);
+    if (!value && static_input) {
+      value = node.find(*static_input);
+    }
+    if (!value) {
+      value = node.find(*json_input);
+    }
+    if (value) {
+      json_eval_stack.push(value);
+      return;
+    }
 
-    try {
-      // First try to evaluate as a loop variable
-      if (json_loop_data.contains(ptr)) {
-        json_eval_stack.push(&json_loop_data.at(ptr));
-      } else {
-        json_eval_stack.push(&json_input->at(ptr));
-      }
+    // Try to evaluate as a no-argument callback, resolved when parsing
+    if (node.callback) {
+      Arguments empty_args {};
+      auto result_ptr = json_tmp_arena.make((*node.callback)(empty_args));
+      json_eval_stack.push(result_ptr);
 
-    } catch (std::exception &) {
-      // Try to evaluate as a no-argument callback
-      auto function_data = function_storage.find_function(node.name, 0);
-      if (function_data.operation == FunctionStorage::Operation::Callback) {
-        Arguments empty_args {};
-        auto value = std::make_shared<json>(function_data.callback(empty_args));
-        json_tmp_stack.push_back(value);
-        json_eval_stack.push(value.get());
+    } else {
+      json_eval_stack.push(nullptr);
+      not_found_stack.emplace(&node);
+    }
+  }
 
-      } else {
-        json_eval_stack.push(nullptr);
-        not_found_stack.emplace(&node);
-      }
+  /// Decides an and, or or default() by its first operand, returns true if the second one is skipped
+  bool short_circuit(const Bytecode& bc) {
+    if (bc.operation == Op::Default) {
+      return json_eval_stack.top() != nullptr;
     }
+    auto value = get_arguments<1>(*bc.node)[0];
+    bool result = truthy(value);
+    if (result == (bc.operation == Op::Or)) {
+      json_eval_stack.push(json_tmp_arena.make(result));
+      return true;
+    }
+    json_eval_stack.push(value);
+    return false;
   }
 
-  void visit(const FunctionNode& node) {
-    std::shared_ptr<json> result_ptr;
+  void call_function(const Bytecode& bc) {
+    const auto& node = *bc.node;
+    json* result_ptr {nullptr};
 
-    switch (node.operation) {
+    switch (bc.operation) {
     case Op::Not: {
       auto args = get_arguments<1>(node);
-      result_ptr = std::make_shared<json>(!truthy(args[0]));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(!truthy(args[0]));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::And: {
+      // the first operand was true if the second one is here, see short_circuit()
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(truthy(args[0]) && truthy(args[1]));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(truthy(args[0]) && truthy(args[1]));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Or: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(truthy(args[0]) || truthy(args[1]));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(truthy(args[0]) || truthy(args[1]));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::In: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(std::find(args[1]->begin(), args[1]->end(), *args[0]) != args[1]->end());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(std::find(args[1]->begin(), args[1]->end(), *args[0]) != args[1]->end());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Equal: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(*args[0] == *args[1]);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(*args[0] == *args[1]);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::NotEqual: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(*args[0] != *args[1]);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(*args[0] != *args[1]);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Greater: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(*args[0] > *args[1]);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(*args[0] > *args[1]);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::GreaterEqual: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(*args[0] >= *args[1]);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(*args[0] >= *args[1]);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Less: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(*args[0] < *args[1]);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(*args[0] < *args[1]);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::LessEqual: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(*args[0] <= *args[1]);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(*args[0] <= *args[1]);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Add: {
       auto args = get_arguments<2>(node);
       if (args[0]->is_string() && args[1]->is_string()) {
-        result_ptr = std::make_shared<json>(args[0]->get<std::string>() + args[1]->get<std::string>());
-        json_tmp_stack.push_back(result_ptr);
-      } else if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-        result_ptr = std::make_shared<json>(args[0]->get<int>() + args[1]->get<int>());
-        json_tmp_stack.push_back(result_ptr);
+        result_ptr = json_tmp_arena.make(args[0]->get<std::string>() + args[1]->get<std::string>());
       } else {
-        result_ptr = std::make_shared<json>(args[0]->get<double>() + args[1]->get<double>());
-        json_tmp_stack.push_back(result_ptr);
+        result_ptr = make_number(Number(*args[0]) + Number(*args[1]));
       }
-      json_eval_stack.push(result_ptr.get());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Subtract: {
       auto args = get_arguments<2>(node);
-      if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-        result_ptr = std::make_shared<json>(args[0]->get<int>() - args[1]->get<int>());
-        json_tmp_stack.push_back(result_ptr);
-      } else {
-        result_ptr = std::make_shared<json>(args[0]->get<double>() - args[1]->get<double>());
-        json_tmp_stack.push_back(result_ptr);
-      }
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = make_number(Number(*args[0]) - Number(*args[1]));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Multiplication: {
       auto args = get_arguments<2>(node);
-      if (args[0]->is_number_integer() && args[1]->is_number_integer()) {
-        result_ptr = std::make_shared<json>(args[0]->get<int>() * args[1]->get<int>());
-        json_tmp_stack.push_back(result_ptr);
-      } else {
-        result_ptr = std::make_shared<json>(args[0]->get<double>() * args[1]->get<double>());
-        json_tmp_stack.push_back(result_ptr);
-      }
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = make_number(Number(*args[0]) * Number(*args[1]));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Division: {
       auto args = get_arguments<2>(node);
-      if (args[1]->get<double>() == 0) {
+      double divisor = Number(*args[1]).to_double();
+      if (divisor == 0) {
         throw_renderer_error("division by zero", node);
       }
-      result_ptr = std::make_shared<json>(args[0]->get<double>() / args[1]->get<double>());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(Number(*args[0]).to_double() / divisor);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Power: {
       auto args = get_arguments<2>(node);
-      if (args[0]->is_number_integer() && args[1]->get<int>() >= 0) {
-        int result = std::pow(args[0]->get<int>(), args[1]->get<int>());
-        result_ptr = std::make_shared<json>(std::move(result));
-        json_tmp_stack.push_back(result_ptr);
-      } else {
-        double result = std::pow(args[0]->get<int>(), args[1]->get<int>());
-        result_ptr = std::make_shared<json>(std::move(result));
-        json_tmp_stack.push_back(result_ptr);
-      }
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = make_number(Number::pow(Number(*args[0]), Number(*args[1])));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Modulo: {
       auto args = get_arguments<2>(node);
-      result_ptr = std::make_shared<json>(args[0]->get<int>() % args[1]->get<int>());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      int64_t divisor = Number(*args[1]).to_integer();
+      if (divisor == 0) {
+        throw_renderer_error("division by zero", node);
+      }
+      result_ptr = json_tmp_arena.make(Number::remainder(Number(*args[0]).to_integer(), divisor));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::At: {
       auto args = get_arguments<2>(node);
@@ -322,42 +354,37 @@ class Renderer : public NodeVisitor  {
     } break;
     case Op::DivisibleBy: {
       auto args = get_arguments<2>(node);
-      int divisor = args[1]->get<int>();
-      result_ptr = std::make_shared<json>((divisor != 0) && (args[0]->get<int>() % divisor == 0));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      int64_t divisor = Number(*args[1]).to_integer();
+      result_ptr = json_tmp_arena.make((divisor != 0) && (Number::remainder(Number(*args[0]).to_integer(), divisor) == 0));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Even: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->get<int>() % 2 == 0);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(Number(*get_arguments<1>(node)[0]).to_integer() % 2 == 0);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Exists: {
       auto &&name = get_arguments<1>(node)[0]->get_ref<const std::string &>();
-      result_ptr = std::make_shared<json>(json_input->find(name) != json_input->end());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      bool exists = json_input->find(name) != json_input->end() || (static_input && static_input->find(name) != static_input->end());
+      result_ptr = json_tmp_arena.make(exists);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::ExistsInObject: {
       auto args = get_arguments<2>(node);
       auto &&name = args[1]->get_ref<const std::string &>();
-      result_ptr = std::make_shared<json>(args[0]->find(name) != args[0]->end());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(args[0]->find(name) != args[0]->end());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::First: {
       auto result = &get_arguments<1>(node)[0]->front();
       json_eval_stack.push(result);
     } break;
     case Op::Float: {
-      result_ptr = std::make_shared<json>(std::stod(get_arguments<1>(node)[0]->get_ref<const std::string &>()));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(std::stod(get_arguments<1>(node)[0]->get_ref<const std::string &>()));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Int: {
-      result_ptr = std::make_shared<json>(std::stoi(get_arguments<1>(node)[0]->get_ref<const std::string &>()));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(static_cast<int64_t>(std::stoll(get_arguments<1>(node)[0]->get_ref<const std::string &>())));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Last: {
       auto result = &get_arguments<1>(node)[0]->back();
@@ -366,19 +393,17 @@ class Renderer : public NodeVisitor  {
     case Op::Length: {
       auto val = get_arguments<1>(node)[0];
       if (val->is_string()) {
-        result_ptr = std::make_shared<json>(val->get_ref<const std::string &>().length());
+        result_ptr = json_tmp_arena.make(val->get_ref<const std::string &>().length());
       } else {
-        result_ptr = std::make_shared<json>(val->size());
+        result_ptr = json_tmp_arena.make(val->size());
       }
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Lower: {
       std::string result = get_arguments<1>(node)[0]->get<std::string>();
       std::transform(result.begin(), result.end(), result.begin(), ::tolower);
-      result_ptr = std::make_shared<json>(std::move(result));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(std::move(result));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Max: {
       auto args = get_arguments<1>(node);
@@ -391,78 +416,69 @@ class Renderer : public NodeVisitor  {
       json_eval_stack.push(&(*result));
     } break;
     case Op::Odd: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->get<int>() % 2 != 0);
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(Number(*get_arguments<1>(node)[0]).to_integer() % 2 != 0);
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Range: {
       std::vector<int> result(get_arguments<1>(node)[0]->get<int>());
       std::iota(result.begin(), result.end(), 0);
-      result_ptr = std::make_shared<json>(std::move(result));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(std::move(result));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Round: {
       auto args = get_arguments<2>(node);
       int precision = args[1]->get<int>();
       double result = std::round(args[0]->get<double>() * std::pow(10.0, precision)) / std::pow(10.0, precision);
-      result_ptr = std::make_shared<json>(std::move(result));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(std::move(result));
+      json_eval_stack.push(result_ptr);
+    } break;
+    case Op::Safe: {
+      // only marks the printed value, see Compiler
+      json_eval_stack.push(get_arguments<1>(node)[0]);
     } break;
     case Op::Sort: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->get<std::vector<json>>());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->get<std::vector<json>>());
       std::sort(result_ptr->begin(), result_ptr->end());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Upper: {
       std::string result = get_arguments<1>(node)[0]->get<std::string>();
       std::transform(result.begin(), result.end(), result.begin(), ::toupper);
-      result_ptr = std::make_shared<json>(std::move(result));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(std::move(result));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::IsBoolean: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->is_boolean());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->is_boolean());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::IsNumber: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->is_number());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->is_number());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::IsInteger: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->is_number_integer());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->is_number_integer());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::IsFloat: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->is_number_float());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->is_number_float());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::IsObject: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->is_object());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->is_object());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::IsArray: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->is_array());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->is_array());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::IsString: {
-      result_ptr = std::make_shared<json>(get_arguments<1>(node)[0]->is_string());
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      result_ptr = json_tmp_arena.make(get_arguments<1>(node)[0]->is_string());
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::Callback: {
-      auto args = get_argument_vector(node.number_args, node);
-      result_ptr = std::make_shared<json>(node.callback(args));
-      json_tmp_stack.push_back(result_ptr);
-      json_eval_stack.push(result_ptr.get());
+      auto args = get_argument_vector(bc.args, node);
+      result_ptr = json_tmp_arena.make((*static_cast<const FunctionNode&>(node).callback)(args));
+      json_eval_stack.push(result_ptr);
     } break;
     case Op::ParenLeft:
     case Op::ParenRight:
@@ -471,113 +487,210 @@ class Renderer : public NodeVisitor  {
     }
   }
 
-  void visit(const ExpressionListNode& node) {
-    print_json(eval_expression_list(node).get());
-  }
-
-  void visit(const StatementNode&) { }
+  bool start_loop(const Bytecode& bc) {
+    const auto& node = static_cast<const ForStatementNode&>(*bc.node);
 
-  void visit(const ForStatementNode&) { }
-
-  void visit(const ForArrayStatementNode& node) {
     auto result = eval_expression_list(node.condition);
-    if (!result->is_array()) {
-      throw_renderer_error("object must be an array", node);
-    }
-
-    if (!current_loop_data->empty()) {
-      auto tmp = *current_loop_data; // Because of clang-3
-      (*current_loop_data)["parent"] = std::move(tmp);
+    LoopLevel level {nullptr, nullptr, result, result->cbegin(), 0, result->size(), nullptr, json_tmp_arena_base};
+    if (bc.op == Bytecode::Op::StartObjectLoop) {
+      if (!result->is_object()) {
+        throw_renderer_error("object must be an object", node);
+      }
+      level.key_name = &static_cast<const ForObjectStatementNode&>(node).key;
+      level.value_name = &static_cast<const ForObjectStatementNode&>(node).value;
+    } else {
+      if (!result->is_array()) {
+        throw_renderer_error("object must be an array", node);
+      }
+      level.value_name = &static_cast<const ForArrayStatementNode&>(node).value;
     }
 
-    for (auto it = result->begin(); it != result->end(); ++it) {
-      json_loop_data[node.value.str()] = *it;
-
-      size_t index = std::distance(result->begin(), it);
-      (*current_loop_data)["index"] = index;
-      (*current_loop_data)["index1"] = index + 1;
-      (*current_loop_data)["is_first"] = (index == 0);
-      (*current_loop_data)["is_last"] = (index == result->size() - 1);
-
-      node.body.accept(*this);
+    if (level.size == 0) {
+      release_temporaries();
+      return false;
     }
-
-    json_loop_data[node.value.str()].clear();
-    if (!(*current_loop_data)["parent"].empty()) {
-      auto tmp = (*current_loop_data)["parent"];
-      *current_loop_data = std::move(tmp);
-    } else {
-      current_loop_data = &json_loop_data["loop"];
+    if (level.key_name) {
+      level.key = level.it.key();
     }
+    // Keep the container alive until the loop ends
+    json_tmp_arena_base = json_tmp_arena.size();
+    loop_stack.push_back(std::move(level));
+    return true;
   }
 
-  void visit(const ForObjectStatementNode& node) {
-    auto result = eval_expression_list(node.condition);
-    if (!result->is_object()) {
-      throw_renderer_error("object must be an object", node);
+  bool next_loop() {
+    auto& level = loop_stack.back();
+    ++level.it;
+    ++level.index;
+    if (level.index == level.size) {
+      json_tmp_arena_base = level.arena_base;
+      loop_stack.pop_back();
+      release_temporaries();
+      return false;
     }
-
-    if (!current_loop_data->empty()) {
-      (*current_loop_data)["parent"] = std::move(*current_loop_data);
+    if (level.key_name) {
+      level.key = level.it.key();
     }
+    return true;
+  }
 
-    for (auto it = result->begin(); it != result->end(); ++it) {
-      json_loop_data[node.key.str()] = it.key();
-      json_loop_data[node.value.str()] = it.value();
-
-      size_t index = std::distance(result->begin(), it);
-      (*current_loop_data)["index"] = index;
-      (*current_loop_data)["index1"] = index + 1;
-      (*current_loop_data)["is_first"] = (index == 0);
-      (*current_loop_data)["is_last"] = (index == result->size() - 1);
+  void release_temporaries() {
+    json_tmp_arena.rewind(json_tmp_arena_base);
+  }
 
-      node.body.accept(*this);
+  void include(const IncludeStatementNode& node) {
+    // The linked template, or the stored one of that name if it was not known when parsing
+    auto included = node.included.lock();
+    if (!included) {
+      auto included_template_it = template_storage.find(node.file);
+      if (included_template_it != template_storage.end()) {
+        included = included_template_it->second;
+      }
     }
 
-    json_loop_data[node.key.str()].clear();
-    json_loop_data[node.value.str()].clear();
-    if (!(*current_loop_data)["parent"].empty()) {
-      *current_loop_data = std::move((*current_loop_data)["parent"]);
-    } else {
-      current_loop_data = &json_loop_data["loop"];
+    if (included) {
+      // Run it in this renderer, so it sees the same data and loops
+      output->hold(included);
+      auto parent_template = current_template;
+      current_template = included.get();
+      execute(included->bytecodes);
+      current_template = parent_template;
+    } else if (config.throw_at_missing_includes) {
+      throw_renderer_error("include '" + node.file + "' not found", node);
     }
   }
 
-  void visit(const IfStatementNode& node) {
-    auto result = eval_expression_list(node.condition);
-    if (truthy(result.get())) {
-      node.true_statement.accept(*this);
-    } else if (node.has_false_statement) {
-      node.false_statement.accept(*this);
+  void execute(const std::vector<Bytecode>& bytecodes) {
+    size_t pc = 0;
+    while (pc < bytecodes.size()) {
+      const auto& bc = bytecodes[pc++];
+
+      switch (bc.op) {
+      case Bytecode::Op::Nop:
+        break;
+      case Bytecode::Op::PrintText: {
+        auto text = static_cast<const TextNode&>(*bc.node).text(current_template->content);
+        output->write_static(text.data(), text.size());
+      } break;
+      case Bytecode::Op::PrintValue: {
+        print_json(eval_expression_list(static_cast<const ExpressionListNode&>(*bc.node)), bc.args != 0);
+        release_temporaries();
+      } break;
+      case Bytecode::Op::PushLiteral: {
+        json_eval_stack.push(&static_cast<const LiteralNode&>(*bc.node).value);
+      } break;
+      case Bytecode::Op::PushVar: {
+        push_variable(static_cast<const JsonNode&>(*bc.node));
+      } break;
+      case Bytecode::Op::Call: {
+        call_function(bc);
+      } break;
+      case Bytecode::Op::ShortCircuit: {
+        if (short_circuit(bc)) {
+          pc = bc.args;
+        }
+      } break;
+      case Bytecode::Op::Jump: {
+        pc = bc.args;
+      } break;
+      case Bytecode::Op::ConditionalJump: {
+        auto result = eval_expression_list(static_cast<const IfStatementNode&>(*bc.node).condition);
+        if (!truthy(result)) {
+          pc = bc.args;
+        }
+        release_temporaries();
+      } break;
+      case Bytecode::Op::StartArrayLoop:
+      case Bytecode::Op::StartObjectLoop: {
+        if (!start_loop(bc)) {
+          pc = bc.args;
+        }
+      } break;
+      case Bytecode::Op::EndLoop: {
+        if (next_loop()) {
+          pc = bc.args;
+        }
+      } break;
+      case Bytecode::Op::Include: {
+        include(static_cast<const IncludeStatementNode&>(*bc.node));
+      } break;
+      }
     }
   }
 
-  void visit(const IncludeStatementNode& node) {
-    auto sub_renderer = Renderer(config, template_storage, function_storage);
-    auto included_template_it = template_storage.find(node.file);
+public:
+  Renderer(const RenderConfig& config, const TemplateStorage &template_storage)
+      : config(config), template_storage(template_storage) { }
 
-    if (included_template_it != template_storage.end()) {
-      sub_renderer.render_to(*output_stream, included_template_it->second, *json_input, &json_loop_data);
-    } else if (config.throw_at_missing_includes) {
-      throw_renderer_error("include '" + node.file + "' not found", node);
-    }
+  void render_to(OutputSink &sink, const Template &tmpl, const json &data) {
+    output = &sink;
+    current_template = &tmpl;
+    json_input = &data;
+    static_input = tmpl.static_data.get();
+    json_tmp_arena_base = 0;
+    json_tmp_arena.rewind(0);
+
+    execute(current_template->bytecodes);
   }
 
-public:
-  Renderer(const RenderConfig& config, const TemplateStorage &template_storage, const FunctionStorage &function_storage)
-      : config(config), template_storage(template_storage), function_storage(function_storage) { }
+  void render_to(std::ostream &os, const Template &tmpl, const json &data) {
+    StreamSink sink(os);
+    render_to(sink, tmpl, data);
+  }
 
-  void render_to(std::ostream &os, const Template &tmpl, const json &data, json *loop_data = nullptr) {
-    output_stream = &os;
+  /// Evaluates the bytecode of an expression of tmpl without any input data
+  json evaluate(const Template &tmpl, const std::vector<Bytecode>& bytecodes) {
+    static const json no_data;
     current_template = &tmpl;
-    json_input = &data;
-    if (loop_data) {
-      json_loop_data = *loop_data;
+    json_input = &no_data;
+    static_input = nullptr;
+    json_eval_stack = std::stack<const json*>();
+    json_tmp_arena.rewind(0);
+
+    execute(bytecodes);
+    if (json_eval_stack.size() != 1 || !json_eval_stack.top()) {
+      throw RenderError("malformed expression");
+    }
+    json result = *json_eval_stack.top();
+    json_eval_stack.pop();
+    json_tmp_arena.rewind(0);
+    return result;
+  }
+
+  /// Writes a value the way an expression prints it
+  static void write_json(OutputSink &sink, const json &value, EscapeMode mode = EscapeMode::None) {
+    if (value.is_string()) {
+      write_escaped(sink, value.get_ref<const std::string &>(), mode);
+      return;
+    }
+    ScalarFormatter formatter;
+    auto text = formatter.format(value);
+    if (!text.empty()) {
+      write_escaped(sink, text, mode);
+    } else {
+      write_escaped(sink, value.dump(), mode);
     }
+  }
 
-    current_template->root.accept(*this);
+  /// Returns whether a value counts as true in conditions
+  static bool truthy(const json* data) {
+    if (data->empty()) {
+      return false;
+    } else if (data->is_number()) {
+      return (*data != 0);
+    } else if (data->is_string()) {
+      return !data->empty();
+    } else if (data->is_boolean()) {
+      return data->get<bool>();
+    }
 
-    json_tmp_stack.clear();
+    // only reached for real errors, with the message of the json library
+    try {
+      data->get<bool>();
+    } catch (json::type_error &e) {
+      throw JsonError(e.what());
+    }
+    return false;
   }
 };
 
@@ -0,0 +1,368 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_SERIALIZER_HPP_
+#define INCLUDE_INJA_SERIALIZER_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <accelerator/Range.h>
+
+#include "function_storage.hpp"
+#include "node.hpp"
+#include "nlohmann/json.hpp"
+
+namespace inja {
+
+/*!
+ * \brief A class for writing the AST of a Template in a binary format.
+ *
+ * Integers are little-endian varints, strings are length-prefixed and
+ * literals are stored as CBOR, so reading them back needs no parsing.
+ */
+class AstWriter : public NodeVisitor {
+  enum class Tag : uint8_t {
+    Text,
+    Expression,
+    Literal,
+    Json,
+    Function,
+    ForArray,
+    ForObject,
+    If,
+    Include,
+  };
+
+  std::string &out;
+
+  void write_tag(Tag tag) {
+    write_uint(static_cast<uint64_t>(tag));
+  }
+
+  void visit(const BlockNode& node) {
+    write_uint(node.nodes.size());
+    for (auto& n : node.nodes) {
+      n->accept(*this);
+    }
+  }
+
+  void visit(const TextNode& node) {
+    write_tag(Tag::Text);
+    write_uint(node.pos);
+    write_uint(node.length);
+    write_string(node.joined);
+  }
+
+  void visit(const ExpressionNode&) { }
+
+  void visit(const LiteralNode& node) {
+    write_tag(Tag::Literal);
+    write_uint(node.pos);
+    auto cbor = nlohmann::json::to_cbor(node.value);
+    write_string(acc::StringPiece(reinterpret_cast<const char *>(cbor.data()), cbor.size()));
+  }
+
+  void visit(const JsonNode& node) {
+    write_tag(Tag::Json);
+    write_uint(node.pos);
+    write_string(node.name);
+  }
+
+  void visit(const FunctionNode& node) {
+    write_tag(Tag::Function);
+    write_uint(node.pos);
+    write_uint(static_cast<uint64_t>(node.operation));
+    write_string(node.name);
+    write_uint(node.number_args);
+  }
+
+  void visit(const ExpressionListNode& node) {
+    write_tag(Tag::Expression);
+    write_uint(node.pos);
+    write_uint(node.rpn_output.size());
+    for (auto& n : node.rpn_output) {
+      n->accept(*this);
+    }
+  }
+
+  void visit(const StatementNode&) { }
+  void visit(const ForStatementNode&) { }
+
+  void visit(const ForArrayStatementNode& node) {
+    write_tag(Tag::ForArray);
+    write_uint(node.pos);
+    write_string(node.value);
+    node.condition.accept(*this);
+    node.body.accept(*this);
+  }
+
+  void visit(const ForObjectStatementNode& node) {
+    write_tag(Tag::ForObject);
+    write_uint(node.pos);
+    write_string(node.key);
+    write_string(node.value);
+    node.condition.accept(*this);
+    node.body.accept(*this);
+  }
+
+  void visit(const IfStatementNode& node) {
+    write_tag(Tag::If);
+    write_uint(node.pos);
+    write_uint(node.is_nested);
+    write_uint(node.has_false_statement);
+    node.condition.accept(*this);
+    node.true_statement.accept(*this);
+    node.false_statement.accept(*this);
+  }
+
+  void visit(const IncludeStatementNode& node) {
+    write_tag(Tag::Include);
+    write_uint(node.pos);
+    write_string(node.file);
+  }
+
+  friend class AstReader;
+
+public:
+  explicit AstWriter(std::string &out) : out(out) { }
+
+  void write_uint(uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  void write_string(acc::StringPiece value) {
+    write_uint(value.size());
+    out.append(value.data(), value.size());
+  }
+
+  void write(const BlockNode& root) {
+    root.accept(*this);
+  }
+};
+
+/*!
+ * \brief A class for reading an AST written by AstWriter.
+ *
+ * Reading stops at the first malformed byte and marks the reader as failed.
+ * So do node positions and text views outside of the template content the
+ * AST was written from. Functions are resolved again by name, so a template
+ * that calls a callback which is not registered any more, or a builtin that
+ * a callback replaces now, fails as well.
+ */
+class AstReader {
+  using Tag = AstWriter::Tag;
+  using Op = FunctionStorage::Operation;
+
+  acc::StringPiece in;
+  const std::string &content;
+  const FunctionStorage &function_storage;
+  bool failed {false};
+
+  // set by relocate(): the position of every node, whose text is copied out of content
+  bool relocated {false};
+  size_t relocated_pos {0};
+
+  size_t read_pos() {
+    size_t pos = read_uint();
+    if (pos > content.size()) {
+      fail();
+    }
+    return relocated ? relocated_pos : pos;
+  }
+
+  bool fail() {
+    failed = true;
+    in.clear();
+    return false;
+  }
+
+  acc::StringPiece read_bytes(size_t size) {
+    if (size > in.size()) {
+      fail();
+      return acc::StringPiece();
+    }
+    auto result = in.subpiece(0, size);
+    in.advance(size);
+    return result;
+  }
+
+  std::string read_string() {
+    return read_bytes(read_uint()).str();
+  }
+
+  void read_expression_list(ExpressionListNode& node) {
+    if (static_cast<Tag>(read_uint()) != Tag::Expression) {
+      fail();
+      return;
+    }
+    node.pos = read_pos();
+    read_expressions(node);
+  }
+
+  void read_expressions(ExpressionListNode& node) {
+    size_t size = read_uint();
+    for (size_t i = 0; i < size && !failed; ++i) {
+      auto expression = read_expression();
+      if (expression) {
+        node.rpn_output.emplace_back(std::move(expression));
+      }
+    }
+  }
+
+  std::shared_ptr<ExpressionNode> read_expression() {
+    auto tag = static_cast<Tag>(read_uint());
+    size_t pos = read_pos();
+    switch (tag) {
+    case Tag::Literal: {
+      auto cbor = read_bytes(read_uint());
+      if (failed) {
+        return nullptr;
+      }
+      auto value = nlohmann::json::from_cbor(cbor.begin(), cbor.end(), true, false);
+      if (value.is_discarded()) {
+        fail();
+        return nullptr;
+      }
+      return std::make_shared<LiteralNode>(value, pos);
+    }
+    case Tag::Json: {
+      auto node = std::make_shared<JsonNode>(read_string(), pos);
+      node->callback = function_storage.find_variable_callback(node->name);
+      return node;
+    }
+    case Tag::Function: {
+      auto operation = static_cast<Op>(read_uint());
+      auto node = std::make_shared<FunctionNode>(operation, pos);
+      node->name = read_string();
+      node->number_args = read_uint();
+      if (!node->name.empty()) {
+        // the functions of this environment may differ from the writer's, e.g. a callback replacing a builtin
+        auto function_data = function_storage.find_function(node->name, node->number_args);
+        if (function_data.operation != operation) {
+          fail();
+          return nullptr;
+        }
+        node->callback = function_data.callback;
+      }
+      return node;
+    }
+    default: {
+      fail();
+      return nullptr;
+    }
+    }
+  }
+
+  void read_block(BlockNode& block) {
+    size_t size = read_uint();
+    for (size_t i = 0; i < size && !failed; ++i) {
+      auto tag = static_cast<Tag>(read_uint());
+      size_t source_pos = read_uint();
+      if (source_pos > content.size()) {
+        fail();
+        break;
+      }
+      size_t pos = relocated ? relocated_pos : source_pos;
+      switch (tag) {
+      case Tag::Text: {
+        size_t length = read_uint();
+        auto node = std::make_shared<TextNode>(pos, length);
+        node->joined = read_string();
+        if (node->joined.empty()) {
+          // a view into content
+          if (length > content.size() - source_pos) {
+            fail();
+            break;
+          }
+          if (relocated) {
+            node->joined.assign(content, source_pos, length);
+          }
+        }
+        block.nodes.emplace_back(node);
+      } break;
+      case Tag::Expression: {
+        auto node = std::make_shared<ExpressionListNode>(pos);
+        read_expressions(*node);
+        block.nodes.emplace_back(node);
+      } break;
+      case Tag::ForArray: {
+        auto node = std::make_shared<ForArrayStatementNode>(read_string(), pos);
+        node->parent = &block;
+        read_expression_list(node->condition);
+        read_block(node->body);
+        block.nodes.emplace_back(node);
+      } break;
+      case Tag::ForObject: {
+        auto key = read_string();
+        auto node = std::make_shared<ForObjectStatementNode>(key, read_string(), pos);
+        node->parent = &block;
+        read_expression_list(node->condition);
+        read_block(node->body);
+        block.nodes.emplace_back(node);
+      } break;
+      case Tag::If: {
+        auto node = std::make_shared<IfStatementNode>(pos);
+        node->parent = &block;
+        node->is_nested = read_uint() != 0;
+        node->has_false_statement = read_uint() != 0;
+        read_expression_list(node->condition);
+        read_block(node->true_statement);
+        read_block(node->false_statement);
+        block.nodes.emplace_back(node);
+      } break;
+      case Tag::Include: {
+        block.nodes.emplace_back(std::make_shared<IncludeStatementNode>(read_string(), pos));
+      } break;
+      default: {
+        fail();
+      }
+      }
+    }
+  }
+
+public:
+  /// content is the text of the template the AST was written from
+  explicit AstReader(acc::StringPiece in, const std::string &content, const FunctionStorage &function_storage)
+      : in(in), content(content), function_storage(function_storage) { }
+
+  /// Reads the AST for another template: all nodes get pos and their text is copied out of content
+  AstReader& relocate(size_t pos) {
+    relocated = true;
+    relocated_pos = pos;
+    return *this;
+  }
+
+  uint64_t read_uint() {
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (in.empty()) {
+        fail();
+        return 0;
+      }
+      uint8_t byte = static_cast<uint8_t>(in.front());
+      in.advance(1);
+      result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (byte < 0x80) {
+        return result;
+      }
+    }
+    fail();
+    return 0;
+  }
+
+  /// Reads the AST into root, returns false if the input is malformed
+  bool read(BlockNode& root) {
+    read_block(root);
+    return !failed && in.empty();
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_SERIALIZER_HPP_
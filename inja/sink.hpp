@@ -0,0 +1,181 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_SINK_HPP_
+#define INCLUDE_INJA_SINK_HPP_
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <accelerator/Range.h>
+
+namespace inja {
+
+/*!
+ * \brief Interface for the output of a render.
+ */
+class OutputSink {
+public:
+  virtual ~OutputSink() = default;
+
+  /// Writes bytes that are only valid during the call
+  virtual void write(const char *data, size_t size) = 0;
+
+  /// Writes bytes owned by the Template, which outlive the render
+  virtual void write_static(const char *data, size_t size) {
+    write(data, size);
+  }
+
+  /// Called with each included template before its text is written
+  virtual void hold(const std::shared_ptr<const void> &) { }
+
+  void write(acc::StringPiece data) {
+    write(data.data(), data.size());
+  }
+};
+
+/*!
+ * \brief Appends the output to a string.
+ */
+class StringSink : public OutputSink {
+  std::string &output;
+
+public:
+  explicit StringSink(std::string &output, size_t reserve = 0) : output(output) {
+    output.reserve(output.size() + reserve);
+  }
+
+  using OutputSink::write;
+
+  void write(const char *data, size_t size) override {
+    output.append(data, size);
+  }
+};
+
+/*!
+ * \brief Writes the output into a fixed buffer.
+ *
+ * Output that does not fit is dropped and marks the sink as overflowed.
+ */
+class BufferSink : public OutputSink {
+  char *buffer;
+  size_t capacity;
+  size_t length {0};
+  bool overflow {false};
+
+public:
+  explicit BufferSink(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) { }
+
+  using OutputSink::write;
+
+  void write(const char *data, size_t size) override {
+    if (size > capacity - length) {
+      size = capacity - length;
+      overflow = true;
+    }
+    std::memcpy(buffer + length, data, size);
+    length += size;
+  }
+
+  size_t size() const {
+    return length;
+  }
+
+  bool overflowed() const {
+    return overflow;
+  }
+};
+
+/*!
+ * \brief Collects the output as iovecs for writev().
+ *
+ * Template text is referenced in place, so the rendered Template must
+ * outlive the iovecs. The sink holds the templates it includes itself, as
+ * reloading or replacing them may free them before the iovecs are written.
+ * Rendered values are copied into a buffer owned by the sink.
+ */
+class IovecSink : public OutputSink {
+  struct Slice {
+    const char *data; // nullptr for a slice of the buffer
+    size_t offset;
+    size_t size;
+  };
+
+  std::vector<Slice> slices;
+  std::string buffer;
+  std::vector<struct iovec> iov;
+  std::vector<std::shared_ptr<const void>> held;
+
+public:
+  using OutputSink::write;
+
+  void write(const char *data, size_t size) override {
+    if (!slices.empty() && slices.back().data == nullptr) {
+      slices.back().size += size;
+    } else {
+      slices.push_back({nullptr, buffer.size(), size});
+    }
+    buffer.append(data, size);
+  }
+
+  void hold(const std::shared_ptr<const void> &owner) override {
+    // a render includes few distinct templates, but maybe many times
+    if (std::find(held.begin(), held.end(), owner) == held.end()) {
+      held.push_back(owner);
+    }
+  }
+
+  void write_static(const char *data, size_t size) override {
+    if (!slices.empty() && slices.back().data != nullptr && slices.back().data + slices.back().size == data) {
+      slices.back().size += size;
+    } else {
+      slices.push_back({data, 0, size});
+    }
+  }
+
+  /// Returns the collected output; valid until the next write
+  const std::vector<struct iovec>& iovecs() {
+    iov.clear();
+    iov.reserve(slices.size());
+    for (auto& slice : slices) {
+      const char *data = slice.data ? slice.data : buffer.data() + slice.offset;
+      iov.push_back({const_cast<char *>(data), slice.size});
+    }
+    return iov;
+  }
+
+  size_t size() const {
+    size_t result = 0;
+    for (auto& slice : slices) {
+      result += slice.size;
+    }
+    return result;
+  }
+};
+
+/*!
+ * \brief Writes the output to the buffer of a std::ostream, bypassing its formatting.
+ */
+class StreamSink : public OutputSink {
+  std::ostream &os;
+
+public:
+  explicit StreamSink(std::ostream &os) : os(os) { }
+
+  using OutputSink::write;
+
+  void write(const char *data, size_t size) override {
+    if (os.rdbuf()->sputn(data, static_cast<std::streamsize>(size)) != static_cast<std::streamsize>(size)) {
+      os.setstate(std::ios_base::badbit);
+    }
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_SINK_HPP_
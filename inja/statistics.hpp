@@ -11,18 +11,39 @@ namespace inja {
  * \brief A class for counting statistics on a Template.
  */
 class StatisticsVisitor : public NodeVisitor {
+  // guesses for the output size before a Template was ever rendered
+  static constexpr size_t assumed_loop_size {8};
+  static constexpr size_t assumed_value_length {8};
+  static constexpr size_t max_loop_weight {assumed_loop_size * assumed_loop_size * assumed_loop_size};
+
+  size_t loop_weight {1};
+
+  void visit_loop(const ForStatementNode& node) {
+    node.condition.accept(*this);
+    size_t outer_weight = loop_weight;
+    if (loop_weight < max_loop_weight) {
+      loop_weight *= assumed_loop_size;
+    }
+    node.body.accept(*this);
+    loop_weight = outer_weight;
+  }
+
   void visit(const BlockNode& node) {
     for (auto& n : node.nodes) {
       n->accept(*this);
     }
   }
 
-  void visit(const TextNode&) { }
+  void visit(const TextNode& node) {
+    estimated_output_size += node.length * loop_weight;
+  }
+
   void visit(const ExpressionNode&) { }
   void visit(const LiteralNode&) { }
 
   void visit(const JsonNode&) {
     variable_counter += 1;
+    estimated_output_size += assumed_value_length * loop_weight;
   }
 
   void visit(const FunctionNode&) { }
@@ -37,13 +58,11 @@ class StatisticsVisitor : public NodeVisitor {
   void visit(const ForStatementNode&) { }
 
   void visit(const ForArrayStatementNode& node) {
-    node.condition.accept(*this);
-    node.body.accept(*this);
+    visit_loop(node);
   }
 
   void visit(const ForObjectStatementNode& node) {
-    node.condition.accept(*this);
-    node.body.accept(*this);
+    visit_loop(node);
   }
 
   void visit(const IfStatementNode& node) {
@@ -56,6 +75,8 @@ class StatisticsVisitor : public NodeVisitor {
 
 public:
   unsigned int variable_counter;
+  // static text plus values, with loop bodies weighted by assumed_loop_size
+  size_t estimated_output_size {0};
 
   explicit StatisticsVisitor() : variable_counter(0) { }
 };
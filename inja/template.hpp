@@ -3,35 +3,126 @@
 #ifndef INCLUDE_INJA_TEMPLATE_HPP_
 #define INCLUDE_INJA_TEMPLATE_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "bytecode.hpp"
 #include "node.hpp"
 #include "statistics.hpp"
+#include "nlohmann/json.hpp"
 
 namespace inja {
 
+/*!
+ * \brief Output size of the previous renders of a Template.
+ *
+ * Keeps a slowly decaying maximum, so a reserve() of this size avoids
+ * reallocations for nearly all renders. Updates from concurrent renders may
+ * overwrite each other, which only makes the hint less precise.
+ */
+class RenderSizeHint {
+  mutable std::atomic<size_t> size {0};
+
+public:
+  RenderSizeHint() = default;
+  RenderSizeHint(const RenderSizeHint& other) : size(other.get()) { }
+
+  RenderSizeHint& operator=(const RenderSizeHint& other) {
+    size.store(other.get(), std::memory_order_relaxed);
+    return *this;
+  }
+
+  size_t get() const {
+    return size.load(std::memory_order_relaxed);
+  }
+
+  void update(size_t rendered_size) const {
+    size_t previous = get();
+    size.store(std::max(rendered_size, previous - previous / 16), std::memory_order_relaxed);
+  }
+};
+
 /*!
  * \brief The main inja Template.
+ *
+ * A parsed Template is immutable: rendering only reads its AST and bytecode,
+ * so the same Template can be rendered from many threads at once. The only
+ * exception is the atomic size_hint, which renders refine as they go.
  */
 struct Template {
   BlockNode root;
   std::string content;
+  std::vector<Bytecode> bytecodes;
+  size_t estimated_output_size {0};
+  RenderSizeHint size_hint;
+
+  // file the template was loaded from and its modification time, for reloading
+  std::string filename;
+  int64_t modified {0};
+  // names of the included templates, also of those that were inlined
+  std::set<std::string> includes;
+  // static data of a specialized template, for the templates it includes
+  std::shared_ptr<const nlohmann::json> static_data;
 
   explicit Template() { }
-  explicit Template(const std::string& content): content(content) { }
+  explicit Template(std::string content): content(std::move(content)) { }
 
   /// Return number of variables (total number, not distinct ones) in the template
-  int count_variables() {
+  int count_variables() const {
     auto statistic_visitor = StatisticsVisitor();
     root.accept(statistic_visitor);
     return statistic_visitor.variable_counter;
   }
+
+  /// Return a good capacity for the output of the next render
+  size_t output_size_hint() const {
+    size_t hint = size_hint.get();
+    return hint > 0 ? hint : estimated_output_size;
+  }
 };
 
-using TemplateStorage = std::map<std::string, Template>;
+using TemplateStorage = std::map<std::string, std::shared_ptr<const Template>>;
+
+/*!
+ * \brief Copy-on-write TemplateStorage shared by a writer and concurrent renders.
+ *
+ * Renders hold a snapshot for their whole duration; update() copies the map,
+ * changes the copy and publishes it atomically.
+ */
+class SharedTemplateStorage {
+  std::shared_ptr<const TemplateStorage> storage;
+  std::unique_ptr<std::mutex> write_mutex;
+
+public:
+  SharedTemplateStorage() : storage(std::make_shared<const TemplateStorage>()), write_mutex(new std::mutex) { }
+  SharedTemplateStorage(const SharedTemplateStorage& other) : storage(other.snapshot()), write_mutex(new std::mutex) { }
+
+  SharedTemplateStorage& operator=(const SharedTemplateStorage& other) {
+    auto next = other.snapshot();
+    std::lock_guard<std::mutex> lock(*write_mutex);
+    std::atomic_store(&storage, next);
+    return *this;
+  }
+
+  std::shared_ptr<const TemplateStorage> snapshot() const {
+    return std::atomic_load(&storage);
+  }
+
+  template<typename F>
+  void update(F f) {
+    std::lock_guard<std::mutex> lock(*write_mutex);
+    auto next = std::make_shared<TemplateStorage>(*storage);
+    f(*next);
+    std::atomic_store(&storage, std::shared_ptr<const TemplateStorage>(std::move(next)));
+  }
+};
 
 } // namespace inja
 
@@ -0,0 +1,174 @@
+// Copyright 2020-present Yeolar
+
+#include <mutex>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "inja/inja.hpp"
+
+using json = nlohmann::json;
+
+const std::string test_file_directory {"../test/data/benchmark/"};
+
+namespace {
+
+std::mutex cache_mutex;
+
+const std::string &load_template(const std::string &filename) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  static std::map<std::string, std::string> templates;
+  auto it = templates.find(filename);
+  if (it == templates.end()) {
+    it = templates.emplace(filename, inja::Environment(test_file_directory).load_file(filename)).first;
+  }
+  return it->second;
+}
+
+const json &load_data(const std::string &filename) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  static std::map<std::string, json> data;
+  auto it = data.find(filename);
+  if (it == data.end()) {
+    it = data.emplace(filename, inja::Environment(test_file_directory).load_json(filename)).first;
+  }
+  return it->second;
+}
+
+// One Template per file, parsed once and rendered by all benchmark threads
+const inja::Template &load_shared_template(const std::string &filename) {
+  const std::string &input = load_template(filename);
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  static std::map<std::string, inja::Template> templates;
+  auto it = templates.find(filename);
+  if (it == templates.end()) {
+    it = templates.emplace(filename, inja::Environment().parse(input)).first;
+  }
+  return it->second;
+}
+
+void set_throughput(benchmark::State &state, size_t bytes) {
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+  state.counters["renders"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+
+} // namespace
+
+static void BM_load_file(benchmark::State &state, const std::string &template_file) {
+  inja::Environment env {test_file_directory};
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string content = env.load_file(template_file);
+    bytes = content.size();
+    benchmark::DoNotOptimize(content);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+static void BM_lex(benchmark::State &state, const std::string &template_file) {
+  const std::string &input = load_template(template_file);
+  inja::LexerConfig config;
+  inja::Lexer lexer(config);
+
+  for (auto _ : state) {
+    lexer.start(input);
+    inja::Token tok;
+    do {
+      tok = lexer.scan();
+      benchmark::DoNotOptimize(tok);
+    } while (tok.kind != inja::Token::Kind::Eof);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+static void BM_parse(benchmark::State &state, const std::string &template_file) {
+  const std::string &input = load_template(template_file);
+  inja::Environment env;
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(env.parse(input));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+static void BM_render(benchmark::State &state, const std::string &template_file, const std::string &data_file) {
+  const json &data = load_data(data_file);
+  inja::Environment env;
+  inja::Template tmpl = env.parse(load_template(template_file));
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string result = env.render(tmpl, data);
+    bytes = result.size();
+    benchmark::DoNotOptimize(result);
+  }
+  set_throughput(state, bytes);
+}
+
+static void BM_render_escaped(benchmark::State &state, const std::string &template_file, const std::string &data_file) {
+  const json &data = load_data(data_file);
+  inja::Environment env;
+  env.set_escape_mode(inja::EscapeMode::Html);
+  inja::Template tmpl = env.parse(load_template(template_file));
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string result = env.render(tmpl, data);
+    bytes = result.size();
+    benchmark::DoNotOptimize(result);
+  }
+  set_throughput(state, bytes);
+}
+
+static void BM_render_threaded(benchmark::State &state, const std::string &template_file, const std::string &data_file) {
+  static const inja::Environment env;
+  const json &data = load_data(data_file);
+  const inja::Template &tmpl = load_shared_template(template_file);
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string result = env.render(tmpl, data);
+    bytes = result.size();
+    benchmark::DoNotOptimize(result);
+  }
+  set_throughput(state, bytes);
+}
+
+static void BM_render_file(benchmark::State &state, const std::string &template_file, const std::string &data_file) {
+  const json &data = load_data(data_file);
+  inja::Environment env {test_file_directory};
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string result = env.render_file(template_file, data);
+    bytes = result.size();
+    benchmark::DoNotOptimize(result);
+  }
+  set_throughput(state, bytes);
+}
+
+BENCHMARK_CAPTURE(BM_load_file, medium_template, "medium_template.txt");
+BENCHMARK_CAPTURE(BM_load_file, large_template, "large_template.txt");
+
+BENCHMARK_CAPTURE(BM_lex, medium_template, "medium_template.txt");
+BENCHMARK_CAPTURE(BM_lex, large_template, "large_template.txt");
+
+BENCHMARK_CAPTURE(BM_parse, medium_template, "medium_template.txt");
+BENCHMARK_CAPTURE(BM_parse, large_template, "large_template.txt");
+
+BENCHMARK_CAPTURE(BM_render, small_data_medium_template, "medium_template.txt", "small_data.json");
+BENCHMARK_CAPTURE(BM_render, large_data_medium_template, "medium_template.txt", "large_data.json");
+BENCHMARK_CAPTURE(BM_render, large_data_large_template, "large_template.txt", "large_data.json");
+
+BENCHMARK_CAPTURE(BM_render_escaped, large_data_large_template, "large_template.txt", "large_data.json");
+
+BENCHMARK_CAPTURE(BM_render_threaded, small_data_medium_template, "medium_template.txt", "small_data.json")
+    ->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency()))->UseRealTime();
+BENCHMARK_CAPTURE(BM_render_threaded, large_data_large_template, "large_template.txt", "large_data.json")
+    ->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency()))->UseRealTime();
+
+BENCHMARK_CAPTURE(BM_render_file, small_data_medium_template, "medium_template.txt", "small_data.json");
+BENCHMARK_CAPTURE(BM_render_file, large_data_large_template, "large_template.txt", "large_data.json");
+
+BENCHMARK_MAIN();
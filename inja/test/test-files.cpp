@@ -1,5 +1,10 @@
 // Copyright (c) 2019 Pantor. All rights reserved.
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+
 #include "test.h"
 
 const std::string test_file_directory {"../test/data/"};
@@ -19,6 +24,12 @@ TEST(inja, loading) {
 
   {
     CHECK(env.render_file(test_file_directory + "include.txt", data), "Answer: Hello Jeff.");
+
+    // the included file is stored once and reused by later parses
+    auto included = env.find_template(test_file_directory + "simple.txt");
+    CHECK(included != nullptr, true);
+    CHECK(env.render_file(test_file_directory + "include.txt", data), "Answer: Hello Jeff.");
+    CHECK(env.find_template(test_file_directory + "simple.txt") == included, true);
   }
 
   {
@@ -83,3 +94,206 @@ TEST(inja, include_without_local_files) {
     CHECK_THROWS_WITH(env.render_file_with_json_file("html/template.txt", "html/data.json"), "[inja.exception.render_error] (at 3:14) include '../test/data/html/header.txt' not found");
   }
 }
+
+TEST(inja, load_directory) {
+  inja::Environment env {test_file_directory};
+  env.set_search_included_templates_in_files(false);
+  env.load_directory("html", "*.txt", 2);
+
+  CHECK(env.render_file_with_json_file("html/template.txt", "html/data.json"), env.load_file("html/result.txt"));
+
+  auto header = env.find_template(test_file_directory + "html/header.txt");
+  CHECK(header != nullptr, true);
+  CHECK(env.find_template(test_file_directory + "html/data.json") == nullptr, true);
+
+  {
+    // includes that do not match the pattern are loaded from their files
+    inja::Environment env_with_files {test_file_directory};
+    env_with_files.load_directory("html", "template.txt");
+    CHECK(env_with_files.find_template(test_file_directory + "html/template.txt") != nullptr, true);
+    CHECK(env_with_files.find_template(test_file_directory + "html/footer.txt") != nullptr, true);
+  }
+}
+
+TEST(inja, cache_directory) {
+  std::string cache_directory = "inja-cache-XXXXXX";
+  REQUIRE(mkdtemp(&cache_directory[0]) != nullptr, true);
+
+  const std::string result = inja::Environment(test_file_directory).load_file("html/result.txt");
+  for (int run = 0; run < 2; ++run) {
+    // the first run stores the template and its includes, the second loads them
+    inja::Environment env {test_file_directory};
+    env.set_cache_directory(cache_directory);
+    CHECK(env.render_file_with_json_file("html/template.txt", "html/data.json"), result);
+    CHECK(inja::list_files(cache_directory + "/", "*.injac").size(), 3);
+  }
+
+  {
+    // a different syntax does not match the stored templates
+    inja::Environment env {test_file_directory};
+    env.set_cache_directory(cache_directory);
+    env.set_expression("(&", "&)");
+    json data;
+    data["name"] = "Peter";
+    CHECK(env.render("Hello (& name &)!", data), "Hello Peter!");
+  }
+
+  {
+    // an environment whose callback replaces a builtin does not use the builtin of another one
+    const std::string input = "{{ upper(\"static\") }} {{ upper(name) }}";
+    json data;
+    data["name"] = "peter";
+    inja::Environment env;
+    env.set_cache_directory(cache_directory);
+    CHECK(env.render(input, data), "STATIC PETER");
+
+    inja::Environment env_with_callback;
+    env_with_callback.set_cache_directory(cache_directory);
+    env_with_callback.add_callback("upper", 1, [](inja::Arguments &args) {
+      return "CB(" + args.at(0)->get<std::string>() + ")";
+    });
+    CHECK(env_with_callback.render(input, data), "CB(static) CB(peter)");
+    CHECK(env.render(input, data), "STATIC PETER");
+  }
+
+  {
+    // an entry whose text reaches past the template is a miss
+    std::string corrupt_directory = cache_directory + "/corrupt";
+    REQUIRE(mkdir(corrupt_directory.c_str(), 0700), 0);
+    inja::Environment env;
+    env.set_cache_directory(corrupt_directory);
+    json data;
+    data["name"] = "Peter";
+    CHECK(env.render("Hello {{ name }}!", data), "Hello Peter!");
+
+    auto entries = inja::list_files(corrupt_directory + "/", "*.injac");
+    REQUIRE(entries.size(), 1);
+    std::string entry = corrupt_directory + "/" + entries[0];
+    std::string content = inja::load_file(entry);
+    // block of 3 nodes, then text at 0 with length 6 and no joined text
+    const std::string text_node {'\x03', '\x00', '\x00', '\x06', '\x00'};
+    size_t pos = content.rfind(text_node);
+    REQUIRE(pos != std::string::npos, true);
+    content[pos + 3] = '\x7f';
+    std::ofstream(entry, std::ios::binary) << content;
+
+    CHECK(env.render("Hello {{ name }}!", data), "Hello Peter!");
+    CHECK(inja::load_file(entry).find(text_node) != std::string::npos, true);
+    unlink(entry.c_str());
+    rmdir(corrupt_directory.c_str());
+  }
+
+  for (auto& file : inja::list_files(cache_directory + "/", "*")) {
+    unlink((cache_directory + "/" + file).c_str());
+  }
+  rmdir(cache_directory.c_str());
+}
+
+TEST(inja, reload_changed_templates) {
+  char directory[] = "inja-reload-XXXXXX";
+  REQUIRE(mkdtemp(directory) != nullptr, true);
+  const std::string path = std::string(directory) + "/";
+  auto write_file = [&](const std::string &name, const std::string &content) {
+    std::ofstream file(path + name);
+    file << content;
+  };
+
+  write_file("item.txt", "- {{ name }}");
+  write_file("list.txt", "List: {% include \"item.txt\" %}");
+  write_file("other.txt", "Other");
+
+  inja::Environment env {path};
+  env.load_directory("", "*.txt");
+  json data;
+  data["name"] = "Peter";
+
+  auto render = [&](const std::string &name) {
+    return env.render(*env.find_template(path + name), data);
+  };
+  CHECK(render("list.txt"), "List: - Peter");
+  CHECK(env.reload_changed_templates(), 0);
+
+  // the changed template and the one that includes it are reparsed
+  write_file("item.txt", "* {{ name }}!");
+  CHECK(env.reload_changed_templates(), 2);
+  CHECK(render("list.txt"), "List: * Peter!");
+  CHECK(render("other.txt"), "Other");
+
+  {
+    // a template that fails to parse keeps its previous version with its includers, the others are reloaded
+    write_file("item.txt", "{{ name");
+    write_file("other.txt", "Other!");
+    bool thrown = false;
+    try {
+      env.reload_changed_templates();
+    } catch (const inja::ParserError &) {
+      thrown = true;
+    }
+    CHECK(thrown, true);
+    CHECK(render("list.txt"), "List: * Peter!");
+    CHECK(render("other.txt"), "Other!");
+
+    write_file("item.txt", "+ {{ name }}");
+    CHECK(env.reload_changed_templates(), 2);
+    CHECK(render("list.txt"), "List: + Peter");
+  }
+
+  {
+    inja::TemplateWatcher watcher(env, std::chrono::milliseconds(10));
+    write_file("other.txt", "Changed");
+    for (int i = 0; i < 500 && render("other.txt") != "Changed"; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(render("other.txt"), "Changed");
+  }
+
+  for (auto &file : inja::list_files(path, "*")) {
+    unlink((path + file).c_str());
+  }
+  rmdir(directory);
+}
+
+TEST(inja, reload_inlined_templates) {
+  char directory[] = "inja-reload-XXXXXX";
+  REQUIRE(mkdtemp(directory) != nullptr, true);
+  const std::string path = std::string(directory) + "/";
+  auto write_file = [&](const std::string &name, const std::string &content) {
+    std::ofstream file(path + name);
+    file << content;
+  };
+
+  // list.txt comes before the partial it includes, which includes another one
+  write_file("list.txt", "List: {% include \"part.txt\" %}");
+  write_file("part.txt", "- {% include \"name.txt\" %}");
+  write_file("name.txt", "{{ name }}");
+
+  inja::Environment env {path};
+  env.set_max_inlined_include_size(16);
+  env.load_directory("", "*.txt");
+  json data;
+  data["name"] = "Peter";
+
+  auto is_inlined = [&](const std::string &name) {
+    auto &bytecodes = env.find_template(path + name)->bytecodes;
+    return std::none_of(bytecodes.begin(), bytecodes.end(), [](const inja::Bytecode &bc) {
+      return bc.op == inja::Bytecode::Op::Include;
+    });
+  };
+  auto render = [&](const std::string &name) {
+    return env.render(*env.find_template(path + name), data);
+  };
+  CHECK(is_inlined("list.txt"), true);
+  CHECK(is_inlined("part.txt"), true);
+  CHECK(render("list.txt"), "List: - Peter");
+
+  // the changed template and the ones that inlined it are reparsed
+  write_file("name.txt", "{{ name }}!");
+  CHECK(env.reload_changed_templates(), 3);
+  CHECK(is_inlined("list.txt"), true);
+  CHECK(render("list.txt"), "List: - Peter!");
+
+  for (auto &file : inja::list_files(path, "*")) {
+    unlink((path + file).c_str());
+  }
+  rmdir(directory);
+}
@@ -1,5 +1,7 @@
 // Copyright (c) 2019 Pantor. All rights reserved.
 
+#include <limits>
+
 #include "test.h"
 
 TEST(inja, functions) {
@@ -29,6 +31,26 @@ TEST(inja, functions) {
     CHECK(env.render("{{ 5 + 12 + 4 * (4 - (1 + 1))^2 - 75 * 1 }}", data), "-42");
   }
 
+  {
+    json numbers;
+    numbers["big"] = 3000000000LL;
+    numbers["max"] = std::numeric_limits<int64_t>::max();
+    numbers["price"] = 2.5;
+    numbers["minus"] = -7;
+
+    CHECK(env.render("{{ big + 1 }}", numbers), "3000000001");
+    CHECK(env.render("{{ big * 3 - big }}", numbers), "6000000000");
+    CHECK(env.render("{{ 2000000000 + 2000000000 }}", numbers), "4000000000");
+    CHECK(env.render("{{ 2^40 }} {{ 2^(minus + 6) }} {{ 1.5^2 }}", numbers), "1099511627776 0.5 2.25");
+    CHECK(env.render("{{ big % 7 }} {{ minus % 3 }}", numbers), "4 -1");
+    CHECK(env.render("{{ even(big) }} {{ odd(big + 1) }} {{ divisibleBy(big, 1000) }}", numbers), "true true true");
+    CHECK(env.render("{{ price * 4 }} {{ big + price }}", numbers), "10.0 3000000002.5");
+    CHECK(env.render("{{ int(\"5000000000\") + 1 }}", numbers), "5000000001");
+    // overflowing integers continue as floats
+    CHECK(env.render("{{ max + 1 }}", numbers), "9.223372036854776e+18");
+    CHECK(env.render("{{ 3^64 }}", numbers), "3.4336838202925124e+30");
+  }
+
   {
     CHECK(env.render("{{ upper(name) }}", data), "PETER");
     CHECK(env.render("{{ upper(  name  ) }}", data), "PETER");
@@ -149,6 +171,11 @@ TEST(inja, functions) {
     CHECK(env.render("{{ default(name, \"nobody\") }}", data), "Peter");
     CHECK(env.render("{{ default(surname, \"nobody\") }}", data), "nobody");
     CHECK(env.render("{{ default(surname, \"{{ surname }}\") }}", data), "{{ surname }}");
+    CHECK(env.render("{{ default(brother.name, \"-\") }}", data), "Chris");
+    CHECK(env.render("{{ default(brother.wife.name, \"-\") }}", data), "-");
+    CHECK(env.render("{{ default(brother.daughters.2, \"-\") }}", data), "-");
+    CHECK(env.render("{{ default(name.first, \"-\") }}", data), "-");
+    CHECK(env.render("{% for n in names %}{{ default(n.first, n) }}{% endfor %}", data), "JeffSebPeterTom");
     //CHECK_THROWS_WITH(env.render("{{ default(surname, lastname) }}", data),
     //                  "[inja.exception.render_error] (at 1:21) variable 'lastname' not found");
   }
@@ -239,6 +266,34 @@ TEST(inja, callbacks) {
     CHECK(env.render("{{ argmax(4, 2, 6) }}", data), "2");
     CHECK(env.render("{{ argmax(0, 2, 6, 8, 3) }}", data), "3");
   }
+
+  {
+    int calls = 0;
+    env.add_callback("expensive", 1, [&calls](inja::Arguments& args) {
+      calls += 1;
+      return *args[0];
+    });
+
+    CHECK(env.render("{{ age < 20 and expensive(true) }}", data), "false");
+    CHECK(env.render("{{ age > 20 or expensive(true) }}", data), "true");
+    CHECK(env.render("{{ default(age, expensive(0)) }}", data), "28");
+    CHECK(env.render("{{ age < 20 and expensive(true) or not expensive(false) }}", data), "true");
+    CHECK(calls, 1);
+    CHECK(env.render("{{ age > 20 and expensive(0) }}", data), "false");
+    CHECK(env.render("{{ age < 20 or expensive(1) }}", data), "true");
+    CHECK(env.render("{{ default(nothing, expensive(0)) }}", data), "0");
+    CHECK(env.render("{{ default(nothing, age < 20 or false) and nothing }}", data), "false");
+    CHECK(calls, 4);
+  }
+
+  {
+    // a callback replaces the builtin with its name and number of arguments
+    env.add_callback("safe", 1, [](inja::Arguments& args) {
+      return "[" + args.at(0)->get<std::string>() + "]";
+    });
+    env.set_escape_mode(inja::EscapeMode::Html);
+    CHECK(env.render("{{ safe(\"<b>\") }}", data), "[&lt;b&gt;]");
+  }
 }
 
 TEST(inja, combinations) {
@@ -1,5 +1,7 @@
 // Copyright (c) 2019 Pantor. All rights reserved.
 
+#include <sstream>
+
 #include "test.h"
 
 TEST(inja, types) {
@@ -35,6 +37,7 @@ TEST(inja, types) {
     CHECK(env.render("Hello {{ names.1 }}!", data), "Hello Seb!");
     CHECK(env.render("Hello {{ brother.name }}!", data), "Hello Chris!");
     CHECK(env.render("Hello {{ brother.daughter0.name }}!", data), "Hello Maria!");
+    CHECK(env.render("Hello {{ brother/daughters.1 }}!", data), "Hello Helen!");
     CHECK(env.render("{{ \"{{ no_value }}\" }}", data), "{{ no_value }}");
 
     CHECK_THROWS_WITH(env.render("{{unknown}}", data), "[inja.exception.render_error] (at 1:3) variable 'unknown' not found");
@@ -43,6 +46,14 @@ TEST(inja, types) {
   {
     CHECK(env.render("Hello{# This is a comment #}!", data), "Hello!");
     CHECK(env.render("{# --- #Todo --- #}", data), "");
+
+    inja::Template tmpl;
+    {
+      // text nodes refer to the template content, which must follow copies
+      inja::Template original = env.parse("Hello{# comment #} {{ name }}{# comment #}!{# comment #}");
+      tmpl = original;
+    }
+    CHECK(env.render(tmpl, data), "Hello Peter!");
   }
 
   {
@@ -62,6 +73,7 @@ TEST(inja, types) {
                      data), "0: Jeff, 1: Seb!");
 
     CHECK(env.render("{% for name in [] %}a{% endfor %}", data), "");
+    CHECK(env.render("{% for name in names %}{{ name }} {% endfor %}{{ name }}", data), "Jeff Seb Peter");
 
     CHECK_THROWS_WITH(env.render("{% for name ins names %}a{% endfor %}", data),
                       "[inja.exception.parser_error] (at 1:13) expected 'in', got 'ins'");
@@ -217,6 +229,200 @@ TEST(inja, templates) {
   }
 }
 
+TEST(inja, sinks) {
+  inja::Environment env;
+  json data;
+  data["name"] = "Peter";
+  data["age"] = 29;
+  inja::Template tmpl = env.parse("Hello {{ name }}, you are {{ age }}!");
+
+  std::ostringstream os;
+  env.render_to(os, tmpl, data);
+  CHECK(os.str(), "Hello Peter, you are 29!");
+
+  char buffer[64];
+  inja::BufferSink buffer_sink(buffer, sizeof(buffer));
+  env.render_to(buffer_sink, tmpl, data);
+  CHECK(std::string(buffer, buffer_sink.size()), "Hello Peter, you are 29!");
+  CHECK(buffer_sink.overflowed(), false);
+
+  inja::BufferSink small_sink(buffer, 8);
+  env.render_to(small_sink, tmpl, data);
+  CHECK(std::string(buffer, small_sink.size()), "Hello Pe");
+  CHECK(small_sink.overflowed(), true);
+
+  inja::IovecSink iovec_sink;
+  env.render_to(iovec_sink, tmpl, data);
+  std::string result;
+  for (auto& iov : iovec_sink.iovecs()) {
+    result.append(static_cast<const char *>(iov.iov_base), iov.iov_len);
+  }
+  CHECK(result, "Hello Peter, you are 29!");
+  CHECK(iovec_sink.size(), result.size());
+  CHECK(iovec_sink.iovecs().size(), 5);
+
+  // included text stays valid when the included template is replaced
+  env.set_search_included_templates_in_files(false);
+  env.include_template("greeting", env.parse("Hello {{ name }}, "));
+  inja::Template outer = env.parse("{% include \"greeting\" %}you are {{ age }}!");
+  inja::IovecSink include_sink;
+  env.render_to(include_sink, outer, data);
+  env.include_template("greeting", env.parse("Bye"));
+  result.clear();
+  for (auto& iov : include_sink.iovecs()) {
+    result.append(static_cast<const char *>(iov.iov_base), iov.iov_len);
+  }
+  CHECK(result, "Hello Peter, you are 29!");
+}
+
+TEST(inja, constant_folding) {
+  inja::Environment env;
+  json data;
+  data["x"] = 1;
+
+  inja::Template tmpl = env.parse("A day has {{ 60 * 60 * 24 }} seconds.");
+  CHECK(tmpl.root.nodes.size(), 1);
+  CHECK(env.render(tmpl, data), "A day has 86400 seconds.");
+
+  tmpl = env.parse("{% if 1 < 2 %}yes{% else %}{{ x }}{% endif %}, {{ upper(\"static\") }}");
+  CHECK(tmpl.root.nodes.size(), 1);
+  CHECK(tmpl.count_variables(), 0);
+  CHECK(env.render(tmpl, data), "yes, STATIC");
+
+  tmpl = env.parse("{{ x + 2 * 3 }}{% if length([]) %}never{% endif %}");
+  CHECK(tmpl.root.nodes.size(), 1);
+  CHECK(env.render(tmpl, data), "7");
+
+  // errors of constant expressions are still reported when rendering
+  tmpl = env.parse("{% if false %}{{ 1 + \"a\" }}{% endif %}{{ exists(\"x\") }}");
+  CHECK(env.render(tmpl, data), "true");
+  tmpl = env.parse("{{ 1 + \"a\" }}");
+  std::string message;
+  try {
+    env.render(tmpl, data);
+  } catch (const json::type_error &e) {
+    message = e.what();
+  }
+  CHECK(message, "[json.exception.type_error.302] type must be number, but is string");
+}
+
+TEST(inja, include_linking) {
+  inja::Environment env;
+  json data;
+  data["items"] = {"a", "b"};
+  data["title"] = "List";
+
+  env.set_search_included_templates_in_files(false);
+  env.set_throw_at_missing_includes(false);
+  env.include_template("item", env.parse("{{ loop.index }}:{{ item }}"));
+  inja::Template tmpl = env.parse("{{ title }} {% for item in items %}{% include \"item\" %}{% include \"later\" %},{% endfor %}");
+  CHECK(env.render(tmpl, data), "List 0:a,1:b,");
+
+  // a replaced or added template is found by name
+  env.include_template("item", env.parse("[{{ item }}]"));
+  env.include_template("later", env.parse("{% if loop.is_last %}!{% endif %}"));
+  CHECK(env.render(tmpl, data), "List [a],[b]!,");
+}
+
+TEST(inja, include_inlining) {
+  inja::Environment env;
+  json data;
+  data["items"] = {"a", "b"};
+
+  env.set_max_inlined_include_size(16);
+  env.include_template("item", env.parse("<{{ item }}>"));
+  env.include_template("separator", env.parse(", "));
+  env.include_template("nested", env.parse("{% include \"separator\" %}"));
+
+  inja::Template tmpl = env.parse("{% for item in items %}{% include \"item\" %}"
+                                  "{% if not loop.is_last %}{% include \"separator\" %}{% endif %}{% endfor %}");
+  CHECK(env.render(tmpl, data), "<a>, <b>");
+  CHECK(std::count_if(tmpl.bytecodes.begin(), tmpl.bytecodes.end(), [](const inja::Bytecode& bc) {
+    return bc.op == inja::Bytecode::Op::Include;
+  }), 0);
+
+  // inlined text merges, also of includes inlined into the included template
+  tmpl = env.parse("a{% include \"separator\" %}b{% include \"nested\" %}c");
+  CHECK(tmpl.root.nodes.size(), 1);
+  CHECK(env.render(tmpl, data), "a, b, c");
+  CHECK(tmpl.includes.size(), 2);
+
+  std::string long_template;
+  for (int i = 0; i < 10; ++i) {
+    long_template += "{{ items }}";
+  }
+  env.include_template("long", env.parse(long_template));
+  tmpl = env.parse("{% include \"long\" %}");
+  CHECK(tmpl.bytecodes.size(), 1);
+}
+
+TEST(inja, specialize) {
+  inja::Environment env;
+  json site;
+  site["title"] = "Inja";
+  site["links"] = {"docs", "code"};
+  site["year"] = 2020;
+  json data;
+  data["user"] = "Peter";
+  data["links"] = {"ignored"};
+
+  inja::Template tmpl = env.parse("{{ upper(title) }} {{ year + 1 }}: Hi {{ user }}!"
+                                  "{% if length(links) > 1 %}{% for title in links %} {{ title }}{{ loop.index }}{% endfor %}{% endif %}");
+  inja::Template specialized = env.specialize(tmpl, site);
+  CHECK(specialized.count_variables(), 3);
+  CHECK(env.render(specialized, data), "INJA 2021: Hi Peter! docs0 code1");
+
+  json all = site;
+  all["user"] = "Peter";
+  CHECK(env.render(tmpl, all), "INJA 2021: Hi Peter! docs0 code1");
+
+  // exists() sees the names of both
+  tmpl = env.parse("{{ exists(\"title\") }} {{ exists(\"user\") }} {{ exists(\"nobody\") }} {{ title }}");
+  specialized = env.specialize(tmpl, site);
+  CHECK(env.render(specialized, data), "true true false Inja");
+  CHECK(env.render(tmpl, all), "true true false Inja");
+
+  // included templates see the static data, inlined or not
+  env.set_search_included_templates_in_files(false);
+  env.include_template("heading", env.parse("<h1>{{ title }}</h1>"));
+  env.include_template("page", env.parse("{% include \"heading\" %}{{ year }}{% if exists(\"year\") %}!{% endif %}"));
+  tmpl = env.parse("{% include \"heading\" %}{% include \"page\" %} {{ user }}");
+  specialized = env.specialize(tmpl, site);
+  CHECK(specialized.count_variables(), 1);
+  CHECK(env.render(specialized, data), "<h1>Inja</h1><h1>Inja</h1>2020! Peter");
+  CHECK(env.render(tmpl, all), "<h1>Inja</h1><h1>Inja</h1>2020! Peter");
+}
+
+TEST(inja, escape_modes) {
+  inja::Environment env;
+  json data;
+  data["text"] = "<a href=\"x\">Tom & Jerry's</a>";
+  data["lines"] = "a\"b\\c\nd\te\x01";
+  data["query"] = "a b&c=d/é";
+  data["list"] = {"<b>"};
+  data["long"] = std::string(40, 'x') + "<" + std::string(40, 'y') + "&";
+
+  env.set_escape_mode(inja::EscapeMode::Html);
+  CHECK(env.render("{{ text }}", data), "&lt;a href=&quot;x&quot;&gt;Tom &amp; Jerry&#39;s&lt;/a&gt;");
+  CHECK(env.render("{{ safe(text) }}", data), "<a href=\"x\">Tom & Jerry's</a>");
+  CHECK(env.render("{{ list }}", data), "[&quot;&lt;b&gt;&quot;]");
+  CHECK(env.render("{{ long }}", data), std::string(40, 'x') + "&lt;" + std::string(40, 'y') + "&amp;");
+  CHECK(env.render("<p>{{ \"a < b\" }}{{ 42 }}{{ safe(\"<br>\") }}</p>", data), "<p>a &lt; b42<br></p>");
+
+  env.set_escape_mode(inja::EscapeMode::Xml);
+  CHECK(env.render("{{ text }}", data), "&lt;a href=&quot;x&quot;&gt;Tom &amp; Jerry&apos;s&lt;/a&gt;");
+
+  env.set_escape_mode(inja::EscapeMode::Json);
+  CHECK(env.render("\"{{ lines }}\"", data), "\"a\\\"b\\\\c\\nd\\te\\u0001\"");
+  CHECK(env.render("{{ long }}", data), data["long"].get<std::string>());
+
+  env.set_escape_mode(inja::EscapeMode::Url);
+  CHECK(env.render("?q={{ query }}", data), "?q=a%20b%26c%3Dd%2F%C3%A9");
+
+  env.set_escape_mode(inja::EscapeMode::None);
+  CHECK(env.render("{{ text }}", data), "<a href=\"x\">Tom & Jerry's</a>");
+}
+
 TEST(inja, other_syntax) {
   json data;
   data["name"] = "Peter";
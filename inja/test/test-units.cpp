@@ -1,5 +1,9 @@
 // Copyright (c) 2019 Pantor. All rights reserved.
 
+#include <cmath>
+#include <limits>
+#include <thread>
+
 #include "test.h"
 
 TEST(inja, source_location) {
@@ -27,6 +31,67 @@ Try this
   CHECK(inja::get_source_location(content, 43).column, 1);
 }
 
+TEST(inja, find_first_of) {
+  std::string text(100, 'a');
+  CHECK(inja::find_first_of(text, 0, "#{"), acc::StringPiece::npos);
+
+  // matches in and after the vectorized blocks
+  for (size_t i : {0, 1, 15, 16, 31, 32, 33, 63, 64, 95, 99}) {
+    std::string input = text;
+    input[i] = '{';
+    CHECK(inja::find_first_of(input, 0, "#{"), i);
+    input[i] = '#';
+    CHECK(inja::find_first_of(input, 0, "#{"), i);
+    CHECK(inja::find_first_of(input, i + 1, "#{"), acc::StringPiece::npos);
+  }
+
+  CHECK(inja::find_first_of("a{b#c", 2, "#{"), 3);
+  CHECK(inja::find_first_of("abc", 0, ""), acc::StringPiece::npos);
+}
+
+TEST(inja, function_storage) {
+  using Op = inja::FunctionStorage::Operation;
+  inja::FunctionStorage storage;
+  auto one = [](inja::Arguments &) { return 1; };
+  for (int i = 0; i < 100; ++i) {
+    storage.add_callback("f" + std::to_string(i), i % 3, one);
+  }
+  storage.add_callback("f0", -1, one);
+  storage.add_builtin("upper", 1, Op::Lower);
+
+  CHECK(storage.find_function("upper", 1).operation == Op::Upper, true);
+  CHECK(storage.find_function("upper", 2).operation == Op::None, true);
+  CHECK(storage.find_function("round", 2).operation == Op::Round, true);
+  CHECK(storage.find_function("f99", 0).operation == Op::Callback, true);
+  CHECK(storage.find_function("f99", 1).operation == Op::None, true);
+  CHECK(storage.find_function("f0", 0).operation == Op::Callback, true);
+  CHECK(storage.find_function("f0", 3).operation == Op::Callback, true);
+  CHECK(storage.find_function("f", 0).operation == Op::None, true);
+  CHECK(storage.find_variable_callback("f3") != nullptr, true);
+  CHECK(storage.find_variable_callback("f4") != nullptr, false);
+
+  // callbacks replace builtins and earlier callbacks
+  storage.add_callback("safe", 1, one);
+  CHECK(storage.find_function("safe", 1).operation == Op::Callback, true);
+  auto two = [](inja::Arguments &) { return 2; };
+  storage.add_callback("f99", 0, two);
+  inja::Arguments no_args;
+  CHECK((*storage.find_function("f99", 0).callback)(no_args).get<size_t>(), 2);
+}
+
+TEST(inja, scalar_formatter) {
+  inja::ScalarFormatter formatter;
+  for (json value : {json(nullptr), json(true), json(false), json(0), json(7), json(-10), json(99), json(100), json(-1234567),
+                     json(std::numeric_limits<int64_t>::min()), json(std::numeric_limits<int64_t>::max()),
+                     json(std::numeric_limits<uint64_t>::max()), json(0.0), json(-0.0), json(0.1), json(-2.5), json(1e21),
+                     json(123456789.125), json(1e-7), json(5e-324), json(1.7976931348623157e308), json(3.0)}) {
+    CHECK(formatter.format(value).str(), value.dump());
+  }
+  CHECK(formatter.format(json(std::nan(""))).str(), "null");
+  CHECK(formatter.format(json("text")).empty(), true);
+  CHECK(formatter.format(json::array()).empty(), true);
+}
+
 TEST(inja, copy_environment) {
   inja::Environment env;
   env.add_callback("double", 1, [](inja::Arguments &args) {
@@ -51,3 +116,56 @@ TEST(inja, copy_environment) {
   // template is unchanged in copy
   CHECK(copy.render(test_tpl, json()), "4");
 }
+
+TEST(inja, render_concurrently) {
+  inja::Environment env;
+  env.add_callback("double", 1, [](inja::Arguments &args) {
+    int number = args.at(0)->get<int>();
+    return 2 * number;
+  });
+  env.include_template("item", env.parse("{{ loop.index }}:{{ double(item) }} "));
+
+  json data;
+  data["items"] = {1, 2, 3, 4};
+  const inja::Template tmpl = env.parse("{% for item in items %}{% include \"item\" %}{% endfor %}");
+  const std::string expected = "0:2 1:4 2:6 3:8 ";
+
+  std::vector<std::string> results(4);
+  std::vector<std::thread> threads;
+  for (auto& result : results) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 100; ++i) {
+        result = env.render(tmpl, data);
+        if (result != expected) {
+          break;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (auto& result : results) {
+    CHECK(result, expected);
+  }
+}
+
+TEST(inja, output_size_hint) {
+  inja::Environment env;
+  json data;
+  data["items"] = {"a", "b", "c"};
+
+  inja::Template tmpl = env.parse("Items: {% for item in items %}<li>{{ item }}</li>{% endfor %}");
+  // text, the loop variable and eight iterations of the body
+  CHECK(tmpl.output_size_hint(), 7 + 8 + 8 * (4 + 8 + 5));
+
+  std::string result = env.render(tmpl, data);
+  CHECK(result, "Items: <li>a</li><li>b</li><li>c</li>");
+  CHECK(tmpl.output_size_hint(), result.size());
+
+  // the hint decays slowly towards smaller outputs
+  data["items"] = json::array();
+  env.render(tmpl, data);
+  CHECK(tmpl.output_size_hint(), result.size() - result.size() / 16);
+}
@@ -4,10 +4,18 @@
 #define INCLUDE_INJA_UTILS_HPP_
 
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <utility>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <accelerator/Range.h>
 
 #include "exceptions.hpp"
@@ -29,6 +37,58 @@ inline acc::StringPiece slice(acc::StringPiece view, size_t start, size_t end) {
   return view.subpiece(start, end - start);
 }
 
+/// Returns the position of the first byte of view at or after pos that is one of chars, or npos.
+/// Compares 32 (AVX2) or 16 (SSE2) bytes at a time against up to 8 chars.
+inline size_t find_first_of(acc::StringPiece view, size_t pos, acc::StringPiece chars) {
+  const char *data = view.data();
+  const size_t size = view.size();
+
+#if defined(__AVX2__)
+  if (!chars.empty() && chars.size() <= 8) {
+    __m256i needles[8];
+    for (size_t i = 0; i < chars.size(); ++i) {
+      needles[i] = _mm256_set1_epi8(chars[i]);
+    }
+    for (; pos + 32 <= size; pos += 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+      __m256i match = _mm256_cmpeq_epi8(block, needles[0]);
+      for (size_t i = 1; i < chars.size(); ++i) {
+        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(block, needles[i]));
+      }
+      uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(match));
+      if (mask != 0) {
+        return pos + __builtin_ctz(mask);
+      }
+    }
+  }
+#elif defined(__SSE2__)
+  if (!chars.empty() && chars.size() <= 8) {
+    __m128i needles[8];
+    for (size_t i = 0; i < chars.size(); ++i) {
+      needles[i] = _mm_set1_epi8(chars[i]);
+    }
+    for (; pos + 16 <= size; pos += 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+      __m128i match = _mm_cmpeq_epi8(block, needles[0]);
+      for (size_t i = 1; i < chars.size(); ++i) {
+        match = _mm_or_si128(match, _mm_cmpeq_epi8(block, needles[i]));
+      }
+      uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(match));
+      if (mask != 0) {
+        return pos + __builtin_ctz(mask);
+      }
+    }
+  }
+#endif
+
+  for (; pos < size; ++pos) {
+    if (std::memchr(chars.data(), data[pos], chars.size()) != nullptr) {
+      return pos;
+    }
+  }
+  return acc::StringPiece::npos;
+}
+
 inline SourceLocation get_source_location(acc::StringPiece content, size_t pos) {
   // Get line and offset position (starts at 1:1)
   auto sliced = slice(content, 0, pos);
@@ -0,0 +1,127 @@
+// Copyright 2020-present Yeolar
+
+#ifndef INCLUDE_INJA_WATCHER_HPP_
+#define INCLUDE_INJA_WATCHER_HPP_
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "environment.hpp"
+
+namespace inja {
+
+/*!
+ * \brief Reloads the file templates of an Environment when they change.
+ *
+ * A background thread waits for inotify events on the directories of the
+ * stored templates and calls Environment::reload_changed_templates(). It
+ * also checks every interval, which is all it does where inotify is not
+ * available. A template that fails to parse keeps its previous version, and
+ * so do the templates that include it; the others are reloaded.
+ * The Environment must outlive the watcher.
+ */
+class TemplateWatcher {
+  Environment &env;
+  const std::chrono::milliseconds interval;
+
+  std::atomic<bool> stopped {false};
+  int stop_pipe[2] {-1, -1};
+  int inotify_fd {-1};
+  std::set<std::string> watched_directories;
+  std::thread thread;
+
+  void watch_directories() {
+#ifdef __linux__
+    if (inotify_fd < 0) {
+      return;
+    }
+    auto templates = env.template_storage.snapshot();
+    for (auto &entry : *templates) {
+      const auto &filename = entry.second->filename;
+      if (filename.empty()) {
+        continue;
+      }
+      size_t slash = filename.find_last_of('/');
+      std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+      if (watched_directories.insert(directory).second) {
+        ::inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE_SELF);
+      }
+    }
+#endif
+  }
+
+  void run() {
+    while (!stopped) {
+      watch_directories();
+
+      struct pollfd fds[2] = {{stop_pipe[0], POLLIN, 0}, {inotify_fd, POLLIN, 0}};
+      int ready = ::poll(fds, inotify_fd >= 0 ? 2 : 1, static_cast<int>(interval.count()));
+      if (stopped) {
+        break;
+      }
+      if (ready > 0 && (fds[1].revents & POLLIN)) {
+        // the events only tell that something changed, reload compares the files
+        char events[4096];
+        while (::read(inotify_fd, events, sizeof(events)) > 0) { }
+      }
+
+      try {
+        env.reload_changed_templates();
+      } catch (const std::exception &) {
+        // keep the previous version until the file changes again
+      }
+    }
+  }
+
+public:
+  explicit TemplateWatcher(Environment &env, std::chrono::milliseconds interval = std::chrono::seconds(1))
+      : env(env), interval(interval) {
+    // close on exec, so that child processes do not keep the pipe open
+#ifdef __linux__
+    int result = ::pipe2(stop_pipe, O_CLOEXEC);
+#else
+    int result = ::pipe(stop_pipe);
+    if (result == 0) {
+      ::fcntl(stop_pipe[0], F_SETFD, FD_CLOEXEC);
+      ::fcntl(stop_pipe[1], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (result != 0) {
+      throw FileError("failed creating pipe for template watcher");
+    }
+#ifdef __linux__
+    inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    thread = std::thread([this] { run(); });
+  }
+
+  TemplateWatcher(const TemplateWatcher&) = delete;
+  TemplateWatcher& operator=(const TemplateWatcher&) = delete;
+
+  ~TemplateWatcher() {
+    stopped = true;
+    char byte = 0;
+    ssize_t written = ::write(stop_pipe[1], &byte, 1);
+    (void)written;
+    thread.join();
+    if (inotify_fd >= 0) {
+      ::close(inotify_fd);
+    }
+    ::close(stop_pipe[0]);
+    ::close(stop_pipe[1]);
+  }
+};
+
+} // namespace inja
+
+#endif // INCLUDE_INJA_WATCHER_HPP_